@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "cpuFeatures.hpp"
+#include "hugePages.hpp"
+#include "numa.hpp"
+#include "perfCounters.hpp"
+#include "radixSort.hpp"
+#include "sortingAlgos.hpp"
+#include "sortNetwork.hpp"
+
+// Kernel micro-benchmarks. Run without arguments for all of them, or name the
+// ones to run: pixSortBench network
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  // Nanoseconds per call of fn, over enough repetitions to run ~50ms
+  double nsPerCall(const std::function<void()>& fn)
+  {
+    size_t reps = 1;
+    for (;;)
+    {
+      auto start = Clock::now();
+      for (size_t r = 0; r < reps; ++r) fn();
+      double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      if (ns > 5e7) return ns / reps;
+      reps *= 2;
+    }
+  }
+
+  // Spans of the last sort that took path p, after resetting the counts and
+  // running sort once. Throws when none did, so a bench cannot quietly time
+  // a different path than the one it is named after.
+  uint64_t spansOn(pixSort::SpanPath p, const char* what, const std::function<void()>& sort)
+  {
+    pixSort::resetSpanStats();
+    sort();
+    uint64_t spans = pixSort::spanStats().paths[int(p)];
+    if (spans == 0)
+    {
+      throw std::runtime_error(std::string(what) + " did not take the expected sort path\n");
+    }
+    return spans;
+  }
+
+  // Sorts many random spans of one length so the timing covers the span
+  // sizes span mode actually produces
+  void benchNetwork()
+  {
+    constexpr size_t spansPerRun = 1024;
+    std::mt19937 rng(42);
+
+    std::printf("sorting network (%s), ns per span\n", pixSort::cpuLevelName(pixSort::cpuLevel()));
+    std::printf("%6s %12s %12s %12s %9s\n", "length", "network", "std::sort", "radix", "speedup");
+    for (size_t n = 2; n <= pixSort::networkMaxSize; n += n < 16 ? 1 : 8)
+    {
+      std::vector<uint32_t> source(n * spansPerRun);
+      for (uint32_t& w : source) w = rng();
+      std::vector<uint32_t> words(source.size());
+
+      auto run = [&](auto&& sort)
+      {
+        return nsPerCall([&]
+        {
+          std::copy(source.begin(), source.end(), words.begin());
+          for (size_t s = 0; s < spansPerRun; ++s) sort(words.data() + s * n);
+        }) / spansPerRun;
+      };
+
+      double network = run([&](uint32_t* w) { pixSort::networkSort(w, n); });
+      double stdSort = run([&](uint32_t* w) { std::sort(w, w + n); });
+      double radix = run([&](uint32_t* w) { pixSort::radixSortWords(w, n, 0, 32); });
+      std::printf("%6zu %12.1f %12.1f %12.1f %8.2fx\n", n, network, stdSort, radix, stdSort / network);
+    }
+
+    // The same through a real line sort: 45 degree lines of a 48-pixel wide
+    // image are at most 48 pixels long, so every line fits networkMaxSize
+    cv::Mat source(4096, 48, CV_8UC3);
+    cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+    pixSort::SortKey key;
+    key.terms = {pixSort::parseKey("luma")};
+    cv::Mat img;
+    auto run = [&] { source.copyTo(img); sortByAngleThresholdCPU(img, 60, 45, key); };
+
+    std::printf("45 degree line sorts of 4096x48, ms per image\n");
+    std::printf("%12s %12s %14s\n", "packed", "network", "network spans");
+    key.engine = pixSort::SortEngine::Packed;
+    double packed = nsPerCall(run) / 1e6;
+    key.engine = pixSort::SortEngine::Network;
+    uint64_t spans = spansOn(pixSort::SpanPath::Network, "--engine network", run);
+    double network = nsPerCall(run) / 1e6;
+    std::printf("%12.2f %12.2f %14llu\n", packed, network, static_cast<unsigned long long>(spans));
+  }
+
+  // Row sorts of a Vec3b image with the radix and packed engines. Every
+  // 8-bit key packs with its pixel into a 32-bit word, with or without a
+  // threshold; brightness needs 10 bits and goes to 64-bit words.
+  void benchPacked()
+  {
+    cv::Mat source(2048, 2048, CV_8UC3);
+    cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    std::printf("packed row sorts of 2048x2048, ms per image\n");
+    std::printf("%12s %10s %12s %12s %9s\n", "key", "threshold", "radix", "packed", "speedup");
+    for (const char* name : {"hue", "luma", "channel:1", "brightness"})
+    {
+      for (int threshold : {0, 100})
+      {
+        pixSort::SortKey key;
+        key.terms = {pixSort::parseKey(name)};
+        cv::Mat img;
+        auto run = [&] { source.copyTo(img); sortByRowThresholdCPU(img, threshold, key); };
+
+        key.engine = pixSort::SortEngine::Radix;
+        double radix = nsPerCall(run) / 1e6;
+        key.engine = pixSort::SortEngine::Packed;
+        bool narrow = std::strcmp(name, "brightness") != 0;
+        spansOn(narrow ? pixSort::SpanPath::Packed32 : pixSort::SpanPath::Packed64, name, run);
+        double packed = nsPerCall(run) / 1e6;
+        std::printf("%12s %10d %12.2f %12.2f %8.2fx\n", name, threshold, radix, packed, radix / packed);
+      }
+    }
+  }
+
+  // Horizontal and vertical sorts of one image at every CPU level this machine
+  // supports, which covers key extraction, histograms and transposes
+  void benchIsa()
+  {
+    cv::Mat source(2048, 2048, CV_8UC3);
+    cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+    pixSort::SortKey key;
+
+    std::printf("full image sorts, ms per image\n");
+    std::printf("%10s %12s %12s\n", "level", "horizontal", "vertical");
+    for (pixSort::CpuLevel level : {pixSort::CpuLevel::Baseline, pixSort::CpuLevel::SSE42, pixSort::CpuLevel::AVX2,
+                                    pixSort::CpuLevel::AVX512, pixSort::CpuLevel::NEON})
+    {
+      try { pixSort::setCpuLevel(level); }
+      catch (const std::runtime_error&) { continue; }
+
+      cv::Mat img;
+      double horizontal = nsPerCall([&] { source.copyTo(img); sortByRowThresholdCPU(img, 0, key); }) / 1e6;
+      double vertical = nsPerCall([&] { source.copyTo(img); sortByColumnThresholdCPU(img, 0, key); }) / 1e6;
+      std::printf("%10s %12.2f %12.2f\n", pixSort::cpuLevelName(level), horizontal, vertical);
+    }
+    pixSort::setCpuLevel(pixSort::CpuLevel::Auto);
+  }
+
+  // Row sorts of a large image whose pages all sit on one node, as after a
+  // single-threaded decode, against the same image placed band by band on
+  // the nodes of the pinned workers that sort it
+  void benchNuma()
+  {
+    cv::Mat source(8192, 8192, CV_8UC3);
+    cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+    pixSort::SortKey key;
+    double gigabytes = source.total() * source.elemSize() / 1e9;
+
+    // every run restores the input the same way, from the pinned workers
+    auto restoreAndSort = [&](cv::Mat& img)
+    {
+      return nsPerCall([&]
+      {
+        size_t rowBytes = source.cols * source.elemSize();
+        pixSort::numaParallelFor(source.rows, [&](const cv::Range& rows)
+        {
+          for (int y = rows.start; y < rows.end; ++y) std::memcpy(img.ptr(y), source.ptr(y), rowBytes);
+        });
+        sortByRowThresholdCPU(img, 100, key);
+      }) / 1e6;
+    };
+
+    std::printf("NUMA row sorts of 8192x8192, %zu node(s), %d thread(s)\n", pixSort::numaNodes().size(),
+                cv::getNumThreads());
+    std::printf("%12s %12s %12s\n", "memory", "ms", "GB/s");
+    pixSort::setNumaPlacement(true);
+    cv::Mat oneNode = source.clone();
+    double remote = restoreAndSort(oneNode);
+    std::printf("%12s %12.2f %12.2f\n", "one node", remote, gigabytes / (remote / 1e3));
+    cv::Mat placed = pixSort::numaPlace(source);
+    double local = restoreAndSort(placed);
+    std::printf("%12s %12.2f %12.2f\n", "placed", local, gigabytes / (local / 1e3));
+    pixSort::setNumaPlacement(false);
+  }
+
+  // Vertical and random sorts of a large image with each huge page mode.
+  // Column walks and random scatter touch a new page almost every pixel, so
+  // these are where fewer TLB misses show. Images and scratch are allocated
+  // after the mode is set, and the bytes column says what backed them.
+  void benchHugePages()
+  {
+    pixSort::SortKey key;
+    std::printf("huge pages, 8192x8192, ms per image\n");
+    std::printf("%10s %12s %12s %12s %12s %12s\n", "mode", "vertical", "random", "explicit MiB", "thp MiB", "plain MiB");
+    for (pixSort::HugePageMode mode : {pixSort::HugePageMode::Off, pixSort::HugePageMode::Transparent,
+                                       pixSort::HugePageMode::Explicit})
+    {
+      pixSort::setHugePages(mode);
+      pixSort::resetHugePageStats();
+      cv::Mat source(8192, 8192, CV_8UC3);
+      cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+      cv::Mat img(source.rows, source.cols, source.type());
+
+      double vertical = nsPerCall([&] { source.copyTo(img); sortByColumnThresholdCPU(img, 100, key); }) / 1e6;
+      double random = nsPerCall([&] { source.copyTo(img); randomSortCPU(img, 0.5f, key); }) / 1e6;
+      pixSort::HugePageStats pages = pixSort::hugePageStats();
+      const char* name = mode == pixSort::HugePageMode::Off ? "off" : mode == pixSort::HugePageMode::Transparent ? "thp" : "explicit";
+      std::printf("%10s %12.2f %12.2f %12.1f %12.1f %12.1f\n", name, vertical, random, pages.explicitBytes / 1048576.0,
+                  pages.transparentBytes / 1048576.0, pages.plainBytes / 1048576.0);
+    }
+    pixSort::setHugePages(pixSort::HugePageMode::Off);
+  }
+
+  // Vertical sorts of a tall image, whole-image transpose against L2-sized
+  // column strips, with cache misses per pixel where counters can be read
+  void benchStrips()
+  {
+    cv::Mat source(16384, 2048, CV_8UC3);
+    cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(256));
+    pixSort::SortKey key;
+    pixSort::startPerfCounters();
+    std::string reason = pixSort::perfUnavailableReason();
+
+    std::printf("vertical sorts of 16384x2048, %d thread(s)%s%s\n", cv::getNumThreads(),
+                reason.empty() ? "" : ", not counted: ", reason.c_str());
+    std::printf("%12s %12s", "columns", "ms");
+    for (int e = 0; e < pixSort::perfEventCount; ++e)
+    {
+      std::printf(" %16s", (pixSort::perfEventName(pixSort::PerfEvent(e)) + std::string("/px")).c_str());
+    }
+    std::printf("\n");
+    for (int width : {0, pixSort::autoStripWidth, 16})
+    {
+      pixSort::setColumnStrips(width);
+      cv::Mat img;
+      double ms = nsPerCall([&] { source.copyTo(img); sortByColumnThresholdCPU(img, 100, key); }) / 1e6;
+
+      source.copyTo(img);
+      {
+        pixSort::PerfStage stage("strips", img.total());
+        sortByColumnThresholdCPU(img, 100, key);
+      }
+      const pixSort::StageCounts& counts = pixSort::perfStages().back();
+      const char* name = width == 0 ? "transposed" : width < 0 ? "L2 strips" : "16 strips";
+      std::printf("%12s %12.2f", name, ms);
+      for (int e = 0; e < pixSort::perfEventCount; ++e)
+      {
+        if (counts.counted[e]) { std::printf(" %16.4f", double(counts.values[e]) / counts.pixels); }
+        else { std::printf(" %16s", "-"); }
+      }
+      std::printf("\n");
+    }
+    pixSort::setColumnStrips(0);
+  }
+
+  struct Bench
+  {
+    const char* name;
+    void (*run)();
+  };
+
+  const Bench benches[] = {
+    {"network", benchNetwork},
+    {"packed", benchPacked},
+    {"isa", benchIsa},
+    {"numa", benchNuma},
+    {"hugepages", benchHugePages},
+    {"strips", benchStrips},
+  };
+}
+
+int main(int argc, char** argv)
+{
+  for (const Bench& bench : benches)
+  {
+    bool selected = argc < 2;
+    for (int a = 1; a < argc; ++a) selected |= std::strcmp(argv[a], bench.name) == 0;
+    if (!selected) continue;
+    try { bench.run(); }
+    catch (const std::runtime_error& e)
+    {
+      std::fprintf(stderr, "%s: %s", bench.name, e.what());
+      return 1;
+    }
+  }
+  return 0;
+}
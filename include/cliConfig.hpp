@@ -1,6 +1,11 @@
 #pragma once
 #include <CLI11.hpp>
 #include <opencv2/opencv.hpp>
+#include "sortKeys.hpp"
+#include "cpuFeatures.hpp"
+#include "imageWriter.hpp"
+#include "hugePages.hpp"
+#include <future>
 
 struct Config
 {
@@ -10,6 +15,11 @@ struct Config
     Horizontal,
     Vertical,
     RandomSort,
+    LocalRandom,
+    Angle,
+    Hilbert,
+    Spiral,
+    Zigzag,
   };
 
   enum class ColorSpace
@@ -20,19 +30,66 @@ struct Config
     YCrCB,
   };
 
+  enum class MaskSource
+  {
+    None,
+    File,
+    Brightness,
+    Edges,
+    Saturation,
+  };
+
+  // One pass of a --chain: a method and the settings it overrides, as
+  // name=value pairs applied over the command-line settings
+  struct Pass
+  {
+    Mode mode;
+    std::vector<std::pair<std::string, std::string>> settings;
+  };
+
   std::string input_file;
   std::string output_file;
+  std::string format = "png"; // for -o -
+  int rawWidth = 0;           // --raw frame size, 0 for a single encoded image
+  int rawHeight = 0;
   Mode mode;
+  std::vector<Pass> chain;
   ColorSpace colorSpace;
+  pixSort::SortKey key;
   int threshold = 0;
   float relEntropy = 0.0f;
+  uint64_t seed = 0;
+  int tile = 32;
+  float angle = 0.0f;
+  int segment = 0;
+  MaskSource maskSource = MaskSource::None;
+  std::string mask_file;
+  int maskLow = 0;
+  int maskHigh = 255;
+  bool alphaMask = false;
+  std::string save_perm_file;
+  std::string apply_perm_file;
+  pixSort::CpuLevel isa = pixSort::CpuLevel::Auto;
+  bool numa = false;
+  bool strips = false;
+  int stripWidth = 0; // 0 sizes strips to L2
+  pixSort::HugePageMode hugePages = pixSort::HugePageMode::Off;
+  bool profile = false;
+  std::string cache_dir;
+  int cacheSize = 1024; // MiB
+  bool cacheStats = false;
+  pixSort::EncodeOptions encode;
   bool write = false;
+  bool transform = false;
+  bool noDisplay = false;
   
   static constexpr int maxAbsBrightness{255+255+255};
 };
 
 void cliSetup (CLI::App& app, Config& config);
 cv::Mat loadImage(const Config& config); 
-void applyImageProcessing(cv::Mat& img, Config& config);
+std::future<void> applyImageProcessing(cv::Mat& img, Config& config);
+void processRawFrames(Config& config);
+void printProfile(const Config& config);
 void displayImage(cv::Mat& img);
 
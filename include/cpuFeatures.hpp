@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+
+// Hot kernels are built once per instruction set level and picked at startup,
+// so one binary without -march flags still uses AVX2 or AVX-512 where present.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PIXSORT_X86_DISPATCH 1
+#define PIXSORT_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+// FMA is left out on purpose: contracting float key math would make results
+// depend on the CPU
+#define PIXSORT_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define PIXSORT_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx512dq,avx2,bmi,bmi2,popcnt")))
+#endif
+
+// NEON is part of the aarch64 baseline, so ARM builds need no dispatch
+#if defined(__ARM_NEON)
+#define PIXSORT_NEON 1
+#endif
+
+// Kernel bodies are force-inlined into each target wrapper, which is what
+// compiles them for that instruction set
+#if defined(__GNUC__)
+#define PIXSORT_INLINE inline __attribute__((always_inline))
+#else
+#define PIXSORT_INLINE inline
+#endif
+
+namespace pixSort
+{
+  enum class CpuLevel
+  {
+    Auto,     // the best level the CPU supports
+    Baseline, // plain x86-64 (SSE2) or whatever the compiler targets
+    SSE42,
+    AVX2,     // with BMI2
+    AVX512,   // F, BW, VL and DQ
+    NEON,
+  };
+
+  // Level the kernels dispatch to. Detected on first use unless set.
+  CpuLevel cpuLevel();
+
+  // Caps dispatch at level, Auto goes back to the detected one. Throws
+  // std::runtime_error when the CPU does not support level.
+  void setCpuLevel(CpuLevel level);
+
+  const char* cpuLevelName(CpuLevel level);
+
+  // Size of one core's L2 cache, 1 MiB when the system does not say
+  size_t l2CacheBytes();
+
+#ifdef PIXSORT_X86_DISPATCH
+  template <typename Kernel, typename... Args>
+  PIXSORT_TARGET_SSE42 void runSSE42(Args&&... args) { Kernel::run(std::forward<Args>(args)...); }
+
+  template <typename Kernel, typename... Args>
+  PIXSORT_TARGET_AVX2 void runAVX2(Args&&... args) { Kernel::run(std::forward<Args>(args)...); }
+
+  template <typename Kernel, typename... Args>
+  PIXSORT_TARGET_AVX512 void runAVX512(Args&&... args) { Kernel::run(std::forward<Args>(args)...); }
+#endif
+
+  // Calls Kernel::run(args...) compiled for cpuLevel(). Kernel::run has to be
+  // a PIXSORT_INLINE static function; anything it calls that is not inlined
+  // runs as baseline code.
+  template <typename Kernel, typename... Args>
+  void dispatch(Args&&... args)
+  {
+    switch (cpuLevel())
+    {
+#ifdef PIXSORT_X86_DISPATCH
+    case CpuLevel::AVX512:
+      runAVX512<Kernel>(std::forward<Args>(args)...);
+      break;
+    case CpuLevel::AVX2:
+      runAVX2<Kernel>(std::forward<Args>(args)...);
+      break;
+    case CpuLevel::SSE42:
+      runSSE42<Kernel>(std::forward<Args>(args)...);
+      break;
+#endif
+    default:
+      Kernel::run(std::forward<Args>(args)...);
+      break;
+    }
+  }
+}
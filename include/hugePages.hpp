@@ -0,0 +1,66 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace pixSort
+{
+  enum class HugePageMode
+  {
+    Off,         // plain pages
+    Transparent, // madvise(MADV_HUGEPAGE), the kernel backs what it can
+    Explicit,    // MAP_HUGETLB from the reserved pool, Transparent when it runs dry
+  };
+
+  // Blocks smaller than this never use huge pages
+  constexpr size_t hugePageSize = size_t(2) << 20;
+
+  // Bytes mapped for blocks of hugePageSize or more since the last reset,
+  // by what backs them
+  struct HugePageStats
+  {
+    uint64_t explicitBytes = 0;
+    uint64_t transparentBytes = 0;
+    uint64_t plainBytes = 0;
+  };
+
+  // Also makes new cv::Mat data of hugePageSize or more come from
+  // hugeAllocate, so images, scratch columns and origin maps follow the mode.
+  // Off by default.
+  HugePageMode hugePageMode();
+  void setHugePages(HugePageMode mode);
+
+  // Blocks of hugePageSize or more are mapped on their own, aligned to
+  // hugePageSize and rounded up to it, with pages as the mode says; smaller
+  // ones come from malloc. Throws std::bad_alloc when out of memory.
+  // Whatever the mode was, hugeDeallocate needs the size passed here.
+  void* hugeAllocate(size_t bytes);
+  void hugeDeallocate(void* data, size_t bytes);
+
+  HugePageStats hugePageStats();
+  void resetHugePageStats();
+
+  // For std::vector scratch that is scattered into or gathered from at random
+  template <typename T>
+  struct HugePageAllocator
+  {
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(hugeAllocate(n * sizeof(T))); }
+    void deallocate(T* data, size_t n) { hugeDeallocate(data, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U>&) const { return false; }
+  };
+
+  template <typename T>
+  using HugeVector = std::vector<T, HugePageAllocator<T>>;
+}
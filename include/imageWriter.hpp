@@ -0,0 +1,23 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+namespace pixSort
+{
+  // Codec settings for the written image; -1 keeps OpenCV's default
+  struct EncodeOptions
+  {
+    int pngLevel = -1;    // zlib level 0-9
+    int jpegQuality = -1; // 0-100
+    int webpQuality = -1; // 1-100, above 100 is lossless
+    bool fast = false;    // PNG level 1 where no level is set explicitly
+  };
+
+  // cv::imwrite parameters for the format of file, holding only the ones
+  // that format reads, so equal lists mean equal encodes
+  std::vector<int> encodeParams(const EncodeOptions& options, const std::string& file);
+
+  // cv::imwrite that throws std::runtime_error when nothing could be written
+  void writeImage(const std::string& file, const cv::Mat& img, const std::vector<int>& params);
+}
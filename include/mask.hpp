@@ -0,0 +1,29 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include "traversal.hpp"
+
+namespace pixSort
+{
+  // Runs of masked pixels per line, as [start, end) positions along the line.
+  // Line k owns spans[offsets[k]] .. spans[offsets[k+1]-1].
+  struct SpanTable
+  {
+    std::vector<cv::Range> spans;
+    std::vector<int> offsets{0};
+
+    size_t lineCount() const { return offsets.size() - 1; }
+  };
+
+  // Masks are CV_8UC1 images of the same size as the input, non-zero = sort.
+  cv::Mat loadMask(const std::string& file, cv::Size size);
+  cv::Mat brightnessMask(const cv::Mat& img, int low, int high);
+  cv::Mat edgeMask(const cv::Mat& img, int low, int high);
+  cv::Mat saturationMask(const cv::Mat& img, int low, int high);
+
+  // Span lists for every row of a rows x cols image, or for every line of a
+  // LineTable. An empty mask yields one span covering each whole line.
+  SpanTable rowSpans(const cv::Mat& mask, int rows, int cols);
+  SpanTable lineSpans(const cv::Mat& mask, const LineTable& lines);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <vector>
+
+namespace pixSort
+{
+  // CPUs of every NUMA node that has any, read from sysfs on Linux. Other
+  // systems report a single node.
+  const std::vector<std::vector<int>>& numaNodes();
+
+  // NUMA placement makes the row sorts run on threads pinned to one CPU
+  // each, with every thread handling the same band of rows on every call.
+  // Memory first touched through numaPlace then stays on the node whose
+  // threads sort it. Off by default.
+  bool numaPlacement();
+  void setNumaPlacement(bool enabled);
+
+  // Splits [0, n) into one contiguous block per worker, the blocks of each
+  // node next to each other, and runs body on them on pinned threads that
+  // are kept between calls. The split only depends on n, the topology and
+  // cv::getNumThreads(). Calls from inside body run inline.
+  void numaParallelFor(int n, const std::function<void(const cv::Range&)>& body);
+
+  // Copy of img whose row bands were first touched by the workers that
+  // numaParallelFor gives them to
+  cv::Mat numaPlace(const cv::Mat& img);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "radixSort.hpp"
+#include "sortKeys.hpp"
+#include "sortNetwork.hpp"
+
+namespace pixSort
+{
+  // Bits a pixel occupies in the low end of a packed word
+  template <typename Pixel>
+  constexpr int pixelBits() { return static_cast<int>(sizeof(Pixel) * 8); }
+
+  // Whether Pixel plus a key of keyBits fit into one Word
+  template <typename Word, typename Pixel>
+  constexpr bool fitsPacked(int keyBits)
+  {
+    return pixelBits<Pixel>() < int(sizeof(Word) * 8) && pixelBits<Pixel>() + keyBits <= int(sizeof(Word) * 8);
+  }
+
+  template <typename Word, typename Pixel>
+  Word packPixel(const Pixel& pixel)
+  {
+    unsigned char bytes[sizeof(Pixel)];
+    std::memcpy(bytes, &pixel, sizeof(Pixel));
+    Word word = 0;
+    for (size_t b = 0; b < sizeof(Pixel); ++b)
+    {
+      word |= Word(bytes[b]) << (8 * b);
+    }
+    return word;
+  }
+
+  template <typename Word, typename Pixel>
+  void unpackPixel(Word word, Pixel& pixel)
+  {
+    unsigned char bytes[sizeof(Pixel)];
+    for (size_t b = 0; b < sizeof(Pixel); ++b)
+    {
+      bytes[b] = static_cast<unsigned char>(word >> (8 * b));
+    }
+    std::memcpy(static_cast<void*>(&pixel), bytes, sizeof(Pixel));
+  }
+
+  // Packs pixels as (key << pixelBits) | pixel into plain Words, e.g.
+  // (key << 24) | bgr for Vec3b. Callers check fitsPacked<Word, Pixel>(packer.bits()) first.
+  template <typename Word, typename Pixel>
+  PIXSORT_INLINE void packWords(const Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer, Word* words)
+  {
+    constexpr int shift = pixelBits<Pixel>();
+    packer.pack(pixels, n, words);
+    for (size_t i = 0; i < n; ++i)
+    {
+      words[i] = (words[i] << shift) | packPixel<Word>(pixels[i]);
+    }
+  }
+
+  template <typename Word, typename Pixel>
+  PIXSORT_INLINE void unpackWords(const Word* words, size_t n, Pixel* pixels)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      unpackPixel(words[i], pixels[i]);
+    }
+  }
+
+  // Sorts pixels through packed words, so radix passes move one aligned word
+  // per pixel instead of a key plus an unaligned 3-byte struct.
+  template <typename Word, typename Pixel>
+  PIXSORT_INLINE void packedSortByKey(Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer)
+  {
+    thread_local std::vector<Word> words;
+    words.resize(n);
+    packWords(pixels, n, packer, words.data());
+    radixSortWords(words.data(), n, pixelBits<Pixel>(), packer.bits());
+    unpackWords(words.data(), n, pixels);
+  }
+
+  // Short spans of 32-bit words go through the SIMD sorting network instead
+  // (n <= networkMaxSize). Ties are ordered by pixel value, not by position.
+  template <typename Pixel>
+  PIXSORT_INLINE void networkSortByKey(Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer)
+  {
+    uint32_t words[networkMaxSize];
+    packWords(pixels, n, packer, words);
+    networkSort(words, n);
+    unpackWords(words, n, pixels);
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "radixSort.hpp"
+#include "hugePages.hpp"
+
+namespace pixSort
+{
+  // Below this many elements per chunk the serial sort wins
+  constexpr size_t parallelChunkSize = size_t(1) << 16;
+
+  // Stable LSD radix sort of pixels[0..n) by keys, like radixSortByKey but
+  // split into chunks over cv::parallel_for_. Each pass counts digits per
+  // chunk, turns the counts into offsets in (digit, chunk) order and scatters
+  // all chunks at once. Stability makes the result independent of how many
+  // chunks or threads there are. keys is used as scratch.
+  template <typename Word, typename Pixel>
+  void parallelRadixSortByKey(Word* keys, Pixel* pixels, size_t n, int bits)
+  {
+    size_t chunks = std::min<size_t>(size_t(std::max(1, cv::getNumThreads())) * 4,
+                                     (n + parallelChunkSize - 1) / parallelChunkSize);
+    if (chunks < 2)
+    {
+      radixSortByKey(keys, pixels, n, bits);
+      return;
+    }
+
+    int digitBits = bits <= 12 ? std::max(bits, 1) : 11;
+    int passes = (bits + digitBits - 1) / digitBits;
+    size_t digits = size_t(1) << digitBits;
+    Word digitMask = Word(digits - 1);
+
+    std::vector<size_t> offsets(chunks * digits);
+    // every pass scatters across all of these
+    HugeVector<Word> keyScratch(n);
+    HugeVector<Pixel> pixelScratch(n);
+
+    Word* srcKeys = keys;
+    Pixel* srcPixels = pixels;
+    Word* dstKeys = keyScratch.data();
+    Pixel* dstPixels = pixelScratch.data();
+    auto chunkStart = [&](size_t c) { return c * n / chunks; };
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+      int shift = pass * digitBits;
+      cv::parallel_for_(cv::Range(0, static_cast<int>(chunks)), [&](const cv::Range& range)
+      {
+        for (int c = range.start; c < range.end; ++c)
+        {
+          size_t* count = offsets.data() + c * digits;
+          std::fill(count, count + digits, 0);
+          for (size_t i = chunkStart(c); i < chunkStart(c + 1); ++i)
+          {
+            ++count[(srcKeys[i] >> shift) & digitMask];
+          }
+        }
+      });
+
+      size_t first = (srcKeys[0] >> shift) & digitMask;
+      size_t firstTotal = 0;
+      for (size_t c = 0; c < chunks; ++c) firstTotal += offsets[c * digits + first];
+      if (firstTotal == n) continue;
+
+      size_t sum = 0;
+      for (size_t d = 0; d < digits; ++d)
+      {
+        for (size_t c = 0; c < chunks; ++c)
+        {
+          size_t bucket = offsets[c * digits + d];
+          offsets[c * digits + d] = sum;
+          sum += bucket;
+        }
+      }
+
+      cv::parallel_for_(cv::Range(0, static_cast<int>(chunks)), [&](const cv::Range& range)
+      {
+        for (int c = range.start; c < range.end; ++c)
+        {
+          size_t* offset = offsets.data() + c * digits;
+          for (size_t i = chunkStart(c); i < chunkStart(c + 1); ++i)
+          {
+            size_t pos = offset[(srcKeys[i] >> shift) & digitMask]++;
+            dstKeys[pos] = srcKeys[i];
+            dstPixels[pos] = srcPixels[i];
+          }
+        }
+      });
+      std::swap(srcKeys, dstKeys);
+      std::swap(srcPixels, dstPixels);
+    }
+
+    if (srcPixels != pixels)
+    {
+      std::copy(srcPixels, srcPixels + n, pixels);
+    }
+  }
+}
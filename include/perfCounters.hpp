@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pixSort
+{
+  enum class PerfEvent
+  {
+    Cycles,
+    Instructions,
+    L1dMisses,    // L1 data cache read misses
+    LlcMisses,    // last level cache misses
+    BranchMisses,
+    PageFaults,   // a software event, so containers without a PMU still get it
+    Count,
+  };
+
+  constexpr int perfEventCount = static_cast<int>(PerfEvent::Count);
+
+  const char* perfEventName(PerfEvent event);
+
+  // Counter totals of one stage, over every thread of the process and every
+  // time a stage of that name ran
+  struct StageCounts
+  {
+    std::string name;
+    uint64_t runs = 0;
+    uint64_t pixels = 0;
+    double ms = 0;
+    uint64_t values[perfEventCount] = {};
+    bool counted[perfEventCount] = {}; // false where the event could not be opened
+  };
+
+  // Opens user-space counters for every event on every thread of the process
+  // (Linux perf_event_open). Threads started later are counted once they
+  // exit, so OpenCV's worker threads are started first. Events that cannot
+  // be opened, like the hardware ones in most containers and VMs, are left
+  // out and perfUnavailableReason() says why; stages still record their time.
+  // Returns whether any event is counted. Later calls do nothing.
+  bool startPerfCounters();
+  std::string perfUnavailableReason();
+
+  // Records the counters and time between construction and destruction as a
+  // stage of perfStages(). Does nothing until startPerfCounters was called.
+  class PerfStage
+  {
+  public:
+    PerfStage(std::string name, uint64_t pixels = 0);
+    ~PerfStage();
+
+    // For stages that only learn their size on the way, like decoding
+    void setPixels(uint64_t pixels) { counts.pixels = pixels; }
+    PerfStage(const PerfStage&) = delete;
+    PerfStage& operator=(const PerfStage&) = delete;
+
+  private:
+    StageCounts counts;
+    bool active;
+    double start;
+  };
+
+  // One entry per stage name, in the order they first ran, so a stream of
+  // frames adds to the same few entries
+  std::vector<StageCounts> perfStages();
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <string>
+
+namespace pixSort
+{
+  // A permutation is a CV_32SC1 image of origins: output pixel (y, x) is the
+  // input pixel with row-major index origins(y, x). The sorts record one when
+  // handed an identity map, and replaying it on another layer of the same
+  // size is a plain gather. Random sorts may repeat an origin.
+  cv::Mat identityOrigins(int rows, int cols);
+
+  // Compact binary file: a header with the size, then one block per row
+  // holding origin - index as zigzag varints, with runs of unmoved pixels
+  // stored as a count. Throws std::runtime_error on I/O or format errors.
+  void savePermutation(const std::string& file, const cv::Mat& origins);
+  cv::Mat loadPermutation(const std::string& file);
+
+  // Gathers src through origins. Works for any depth and channel count, so
+  // depth, normal and alpha layers can follow the sorted base image.
+  cv::Mat applyPermutation(const cv::Mat& src, const cv::Mat& origins);
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include "cpuFeatures.hpp"
+
+namespace pixSort
+{
+  // Below this many elements an insertion sort beats clearing the histogram
+  constexpr size_t radixCutoff = 32;
+
+  // Stable LSD radix sort of pixels[0..n) by the low `bits` bits of keys
+  // (uint32_t or uint64_t words). Keys up to 12 bits take a single counting
+  // pass, wider ones use 11-bit digits, so 16-bit and float keys stay linear.
+  // keys is used as scratch and does not hold the sorted keys after.
+  // Inlined into the per-CPU-level span sort kernels.
+  template <typename Word, typename Pixel>
+  PIXSORT_INLINE void radixSortByKey(Word* keys, Pixel* pixels, size_t n, int bits)
+  {
+    if (n < 2) return;
+
+    if (n <= radixCutoff)
+    {
+      for (size_t i = 1; i < n; ++i)
+      {
+        Word key = keys[i];
+        Pixel pixel = pixels[i];
+        size_t j = i;
+        for (; j > 0 && keys[j - 1] > key; --j)
+        {
+          keys[j] = keys[j - 1];
+          pixels[j] = pixels[j - 1];
+        }
+        keys[j] = key;
+        pixels[j] = pixel;
+      }
+      return;
+    }
+
+    int digitBits = bits <= 12 ? std::max(bits, 1) : 11;
+    int passes = (bits + digitBits - 1) / digitBits;
+    Word digitMask = (Word(1) << digitBits) - 1;
+
+    thread_local std::vector<uint32_t> count;
+    thread_local std::vector<Word> keyScratch;
+    thread_local std::vector<Pixel> pixelScratch;
+    count.resize(size_t(1) << digitBits);
+    keyScratch.resize(n);
+    pixelScratch.resize(n);
+
+    Word* srcKeys = keys;
+    Pixel* srcPixels = pixels;
+    Word* dstKeys = keyScratch.data();
+    Pixel* dstPixels = pixelScratch.data();
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+      int shift = pass * digitBits;
+      std::fill(count.begin(), count.end(), 0);
+      for (size_t i = 0; i < n; ++i)
+      {
+        ++count[(srcKeys[i] >> shift) & digitMask];
+      }
+      // a digit shared by every key would not move anything
+      if (count[(srcKeys[0] >> shift) & digitMask] == n) continue;
+
+      uint32_t sum = 0;
+      for (uint32_t& c : count)
+      {
+        uint32_t bucket = c;
+        c = sum;
+        sum += bucket;
+      }
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        uint32_t pos = count[(srcKeys[i] >> shift) & digitMask]++;
+        dstKeys[pos] = srcKeys[i];
+        dstPixels[pos] = srcPixels[i];
+      }
+      std::swap(srcKeys, dstKeys);
+      std::swap(srcPixels, dstPixels);
+    }
+
+    if (srcPixels != pixels)
+    {
+      std::copy(srcPixels, srcPixels + n, pixels);
+    }
+  }
+
+  // Stable LSD radix sort of plain words by their bits [lowBit, lowBit + bits),
+  // for pixels packed into the low bits of a word with their key above them.
+  // Every pass moves a single aligned word per pixel and needs no payload.
+  template <typename Word>
+  PIXSORT_INLINE void radixSortWords(Word* words, size_t n, int lowBit, int bits)
+  {
+    if (n < 2) return;
+
+    if (n <= radixCutoff)
+    {
+      for (size_t i = 1; i < n; ++i)
+      {
+        Word word = words[i];
+        size_t j = i;
+        for (; j > 0 && (words[j - 1] >> lowBit) > (word >> lowBit); --j)
+        {
+          words[j] = words[j - 1];
+        }
+        words[j] = word;
+      }
+      return;
+    }
+
+    int digitBits = bits <= 12 ? std::max(bits, 1) : 11;
+    int passes = (bits + digitBits - 1) / digitBits;
+    Word digitMask = (Word(1) << digitBits) - 1;
+
+    thread_local std::vector<uint32_t> count;
+    thread_local std::vector<Word> scratch;
+    count.resize(size_t(1) << digitBits);
+    scratch.resize(n);
+
+    Word* src = words;
+    Word* dst = scratch.data();
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+      int shift = lowBit + pass * digitBits;
+      std::fill(count.begin(), count.end(), 0);
+      for (size_t i = 0; i < n; ++i)
+      {
+        ++count[(src[i] >> shift) & digitMask];
+      }
+      if (count[(src[0] >> shift) & digitMask] == n) continue;
+
+      uint32_t sum = 0;
+      for (uint32_t& c : count)
+      {
+        uint32_t bucket = c;
+        c = sum;
+        sum += bucket;
+      }
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        dst[count[(src[i] >> shift) & digitMask]++] = src[i];
+      }
+      std::swap(src, dst);
+    }
+
+    if (src != words)
+    {
+      std::copy(src, src + n, words);
+    }
+  }
+
+  // Rearranges pixels in place so that pixels[i] becomes the old
+  // pixels[order[i]], walking every cycle of the permutation once. Each pixel
+  // moves a single time; order is left as the identity.
+  template <typename Pixel>
+  PIXSORT_INLINE void permuteInPlace(Pixel* pixels, uint32_t* order, size_t n)
+  {
+    for (size_t start = 0; start < n; ++start)
+    {
+      if (order[start] == start) continue;
+      Pixel first = pixels[start];
+      size_t j = start;
+      while (order[j] != start)
+      {
+        size_t from = order[j];
+        pixels[j] = pixels[from];
+        order[j] = static_cast<uint32_t>(j);
+        j = from;
+      }
+      pixels[j] = first;
+      order[j] = static_cast<uint32_t>(j);
+    }
+  }
+}
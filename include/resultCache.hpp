@@ -0,0 +1,55 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+
+namespace pixSort
+{
+  // XXH64 of data (little-endian reads, as the reference implementation does
+  // on x86 and ARM)
+  uint64_t xxHash64(const void* data, size_t size, uint64_t seed = 0);
+
+  // Hash of the size, type and pixels, independent of row padding
+  uint64_t hashImage(const cv::Mat& img);
+
+  // Hash of a file's bytes, e.g. a mask the result depends on
+  uint64_t hashFile(const std::string& file);
+
+  struct CacheStats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+  };
+
+  // On-disk cache of encoded results in one directory, keyed on a 64-bit hash
+  // of the input and everything that affects the output. Entries keep the
+  // output's extension, so each format is cached separately. The least
+  // recently used entries are evicted once the directory exceeds maxBytes;
+  // hits refresh an entry's modification time, which is its LRU age.
+  class ResultCache
+  {
+  public:
+    ResultCache(const std::string& dir, uint64_t maxBytes);
+
+    // On a hit, hard links (or copies) the cached entry to output and
+    // returns true. Entries are read-only, so a linked output is too.
+    bool fetch(uint64_t key, const std::string& output);
+
+    // Adds the freshly written output under key and evicts down to the cap
+    void store(uint64_t key, const std::string& output);
+
+    // Hit and miss counts are kept across runs in the directory
+    CacheStats stats() const;
+
+  private:
+    std::string entryPath(uint64_t key, const std::string& output) const;
+    void saveCounts() const;
+
+    std::string dir;
+    uint64_t maxBytes;
+    CacheStats counts;
+  };
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace pixSort
+{
+  struct WorkerStats
+  {
+    uint64_t chunks = 0; // chunks run, stolen ones included
+    uint64_t steals = 0; // successful steals, each taking half a deque
+    double busyMs = 0;   // time inside the loop body
+    double idleMs = 0;   // time in the loops it took part in, minus busyMs
+  };
+
+  // Runs body over [0, n) in chunks on cv::parallel_for_ workers. Every
+  // worker starts with a contiguous share of the chunks in its own deque,
+  // takes chunks from the front and, once it runs dry, steals the back half
+  // of another worker's deque. Uneven rows (thresholds, masks) so keep all
+  // workers busy, and the result never depends on which worker ran a chunk.
+  void stealingParallelFor(int n, const std::function<void(const cv::Range&)>& body);
+
+  // Per worker totals over all stealingParallelFor calls since the last reset
+  std::vector<WorkerStats> schedulerStats();
+  void resetSchedulerStats();
+}
@@ -0,0 +1,322 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace pixSort
+{
+  // How key values are represented for each channel depth. Keys keep the
+  // 8-bit scale times `scale` (x257 for 16-bit, /255 for float), so one
+  // threshold means the same thing at every depth.
+  template <typename T> struct ChannelTraits;
+
+  template <> struct ChannelTraits<uchar>
+  {
+    using Value = int;
+    static constexpr int bits = 8;
+    static constexpr int max = 255;
+    static constexpr double scale = 1.0;
+  };
+
+  template <> struct ChannelTraits<ushort>
+  {
+    using Value = int;
+    static constexpr int bits = 16;
+    static constexpr int max = 65535;
+    static constexpr double scale = 257.0;
+  };
+
+  // Float keys are sorted through their order-preserving bit pattern, which
+  // is packed with 31 bits (see sortableBits)
+  template <> struct ChannelTraits<float>
+  {
+    using Value = float;
+    static constexpr int bits = 31;
+    static constexpr int max = 1;
+    static constexpr double scale = 1.0 / 255.0;
+  };
+
+  // Width of a key that needs integerBits for integer channels
+  template <typename T>
+  constexpr int keyBits(int integerBits)
+  {
+    return std::is_floating_point<T>::value ? ChannelTraits<T>::bits : integerBits;
+  }
+
+  // Sort keys are plain functors so every key gets its own inlined kernel.
+  // All of them read the first three channels in storage (BGR) order and
+  // return a non-negative value below 2^bits() (any float for float images).
+
+  template <typename T>
+  struct BrightnessKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const { return Value(p[0]) + Value(p[1]) + Value(p[2]); }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits + 2); }
+  };
+
+  // Same 0-179 scale as OpenCV's 8-bit HSV
+  template <typename T>
+  struct HueKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const
+    {
+      if constexpr (std::is_same<T, uchar>::value)
+      {
+        int b = p[0], g = p[1], r = p[2];
+        int max = std::max(b, std::max(g, r));
+        int diff = max - std::min(b, std::min(g, r));
+        if (diff == 0) return 0;
+        int h = max == r ? 60 * (g - b) / diff
+              : max == g ? 120 + 60 * (b - r) / diff
+              :            240 + 60 * (r - g) / diff;
+        return (h < 0 ? h + 360 : h) / 2;
+      }
+      else
+      {
+        float b = p[0], g = p[1], r = p[2];
+        float max = std::max(b, std::max(g, r));
+        float diff = max - std::min(b, std::min(g, r));
+        if (diff <= 0) return 0;
+        float h = max == r ? 60 * (g - b) / diff
+                : max == g ? 120 + 60 * (b - r) / diff
+                :            240 + 60 * (r - g) / diff;
+        return static_cast<Value>((h < 0 ? h + 360 : h) * 0.5 * ChannelTraits<T>::scale);
+      }
+    }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  template <typename T>
+  struct SaturationKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const
+    {
+      Value max = std::max(p[0], std::max(p[1], p[2]));
+      Value min = std::min(p[0], std::min(p[1], p[2]));
+      if (max == 0) return 0;
+      if constexpr (std::is_floating_point<T>::value) { return (max - min) / max; }
+      else { return static_cast<Value>(int64_t(ChannelTraits<T>::max) * (max - min) / max); }
+    }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  template <typename T>
+  struct MaxKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const { return std::max(p[0], std::max(p[1], p[2])); }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  template <typename T>
+  struct MinKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const { return std::min(p[0], std::min(p[1], p[2])); }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  // BT.601 luma in 8.8 fixed point
+  template <typename T>
+  struct LumaKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const
+    {
+      if constexpr (std::is_floating_point<T>::value) { return (29 * p[0] + 150 * p[1] + 77 * p[2]) / 256.0f; }
+      else { return (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8; }
+    }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  template <typename T>
+  struct ChannelKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    int channel;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const { return p[channel]; }
+    int bits() const { return keyBits<T>(ChannelTraits<T>::bits); }
+  };
+
+  // Per-channel weights, in 8.8 fixed point for integer channels and shifted
+  // by bias so negative weights still give non-negative keys
+  template <typename T>
+  struct WeightedKey
+  {
+    using Value = typename ChannelTraits<T>::Value;
+    float factors[3];
+    int weights[3];
+    int bias;
+    int range;
+    template <int cn>
+    Value operator()(const cv::Vec<T, cn>& p) const
+    {
+      if constexpr (std::is_floating_point<T>::value) { return factors[0] * p[0] + factors[1] * p[1] + factors[2] * p[2]; }
+      else { return ((weights[0] * p[0] + weights[1] * p[1] + weights[2] * p[2]) >> 8) + bias; }
+    }
+    int bits() const
+    {
+      int bits = 1;
+      while ((range >> bits) != 0) ++bits;
+      return keyBits<T>(bits);
+    }
+  };
+
+  struct KeySpec
+  {
+    enum class Kind
+    {
+      Brightness, // sum of the channels
+      Hue,
+      Saturation,
+      Value,
+      Luma,
+      Channel,
+      Max,
+      Min,
+      Weighted,
+    };
+
+    Kind kind = Kind::Brightness;
+    int channel = 0;
+    float weights[3] = {1.0f, 1.0f, 1.0f};
+  };
+
+  enum class SortOrder
+  {
+    Ascending,
+    Descending, // sorted pixels descending, dim pixels still last
+    Reverse,    // the ascending result read backwards, dim pixels first
+  };
+
+  // How the packed keys get sorted. Radix and Packed give the same (stable)
+  // result; Network orders equal keys in short spans by pixel value instead.
+  enum class SortEngine
+  {
+    Radix,   // keys and pixel indices in separate arrays, pixels moved once at the end
+    Packed,  // key and pixel in one integer word where they fit, else Radix
+    Network, // Packed, with spans of up to 64 32-bit words on a sorting network
+  };
+
+  // Keys compared lexicographically: the first term decides, later terms
+  // break ties. The threshold always applies to the first term.
+  struct SortKey
+  {
+    std::vector<KeySpec> terms{KeySpec{}};
+    SortOrder order = SortOrder::Ascending;
+    SortEngine engine = SortEngine::Packed;
+  };
+
+  // Parses brightness|hue|sat|value|luma|channel:N|max|min|weighted:w0,w1,w2.
+  // Throws std::invalid_argument on anything else.
+  KeySpec parseKey(const std::string& text);
+
+  template <typename T>
+  WeightedKey<T> weightedKey(const KeySpec& spec)
+  {
+    WeightedKey<T> key{};
+    int64_t low = 0, high = 0;
+    for (int c = 0; c < 3; ++c)
+    {
+      key.factors[c] = spec.weights[c];
+      key.weights[c] = cvRound(spec.weights[c] * 256);
+      (key.weights[c] < 0 ? low : high) += int64_t(key.weights[c]) * ChannelTraits<T>::max;
+    }
+    key.bias = static_cast<int>(-(low >> 8));
+    key.range = static_cast<int>((high >> 8) + key.bias);
+    return key;
+  }
+
+  // Calls fn with the functor matching spec for channel type T, resolving the
+  // key once per call instead of once per pixel.
+  template <typename T, typename Fn>
+  void withKey(const KeySpec& spec, Fn&& fn)
+  {
+    switch (spec.kind)
+    {
+    case KeySpec::Kind::Hue:
+      fn(HueKey<T>{});
+      break;
+    case KeySpec::Kind::Saturation:
+      fn(SaturationKey<T>{});
+      break;
+    case KeySpec::Kind::Value:
+    case KeySpec::Kind::Max:
+      fn(MaxKey<T>{});
+      break;
+    case KeySpec::Kind::Luma:
+      fn(LumaKey<T>{});
+      break;
+    case KeySpec::Kind::Channel:
+      fn(ChannelKey<T>{spec.channel});
+      break;
+    case KeySpec::Kind::Min:
+      fn(MinKey<T>{});
+      break;
+    case KeySpec::Kind::Weighted:
+      fn(weightedKey<T>(spec));
+      break;
+    default:
+      fn(BrightnessKey<T>{});
+      break;
+    }
+  }
+
+  // Order-preserving 31-bit image of a float (drops the lowest mantissa bit)
+  inline uint32_t sortableBits(float v)
+  {
+    uint32_t u;
+    std::memcpy(&u, &v, sizeof(u));
+    u ^= static_cast<uint32_t>(static_cast<int32_t>(u) >> 31) | 0x80000000u;
+    return u >> 1;
+  }
+
+  inline uint32_t sortableBits(int v) { return static_cast<uint32_t>(v); }
+
+  // Packs all terms of a SortKey, the threshold and the order into one
+  // unsigned integer per pixel, so a single radix pass sorts by all of them.
+  // Dim pixels share one key and so keep their relative order. The first term
+  // is stored relative to the threshold, which frees values at the top of its
+  // range for the dim key, so a threshold costs no extra bit: one 8-bit key
+  // and a Vec3b still fit a 32-bit word. Keys wider than 32 bits (16-bit and
+  // float images, several terms) need uint64_t words.
+  template <typename Pixel>
+  class KeyPacker
+  {
+  public:
+    using Channel = typename Pixel::value_type;
+    using Value = typename ChannelTraits<Channel>::Value;
+
+    KeyPacker(const SortKey& key, float threshold);
+
+    // Significant bits of the packed keys
+    int bits() const { return totalBits; }
+    bool wide() const { return totalBits > 32; }
+    SortEngine engine() const { return key.engine; }
+
+    template <typename Word>
+    void pack(const Pixel* pixels, size_t n, Word* keys) const;
+
+  private:
+    SortKey key;
+    std::vector<int> termBits;
+    Value threshold;
+    uint64_t offset;   // subtracted from the first term of pixels that are not dim, 0 if none can be
+    uint64_t dimFirst; // first term of dim pixels, above that of every other pixel
+    int totalBits;
+  };
+}
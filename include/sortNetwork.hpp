@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace pixSort
+{
+  // Longest span the sorting network handles
+  constexpr size_t networkMaxSize = 64;
+
+  // Sorts words[0..n), n <= networkMaxSize, ascending with a bitonic sorting
+  // network, with AVX-512, AVX2, SSE4.2 and NEON kernels picked by
+  // cpuLevel() and a scalar fallback; fewer than 8 words take an insertion
+  // sort. Whole words are compared, so for packed key+pixel words equal keys
+  // end up ordered by pixel value rather than by position.
+  void networkSort(uint32_t* words, size_t n);
+}
@@ -1,7 +1,63 @@
 #pragma once 
 #include <opencv2/opencv.hpp>
+#include "traversal.hpp"
+#include "sortKeys.hpp"
 
-void sortByColumnThresholdCPU(cv::Mat& img, float threshold);
-void sortByRowThresholdCPU(cv::Mat& img, float threshold);
-void randomSortCPU(cv::Mat& img, float relEntropy);
-void imagePrint(cv::Mat& img);
\ No newline at end of file
+// An empty mask sorts whole lines; otherwise only runs of non-zero mask pixels.
+// Given origins (see pixSort::identityOrigins), every sort also moves it along
+// with the pixels, recording the permutation it applied.
+void sortByColumnThresholdCPU(cv::Mat& img, float threshold, const pixSort::SortKey& key = {}, const cv::Mat& mask = cv::Mat(),
+                              cv::Mat* origins = nullptr);
+void sortByRowThresholdCPU(cv::Mat& img, float threshold, const pixSort::SortKey& key = {}, const cv::Mat& mask = cv::Mat(),
+                           cv::Mat* origins = nullptr);
+void sortByAngleThresholdCPU(cv::Mat& img, float threshold, float angle,
+                             const pixSort::SortKey& key = {}, const cv::Mat& mask = cv::Mat(), cv::Mat* origins = nullptr);
+void sortByCurveThresholdCPU(cv::Mat& img, float threshold, pixSort::Curve curve, int segmentLength,
+                             const pixSort::SortKey& key = {}, const cv::Mat& mask = cv::Mat(), cv::Mat* origins = nullptr);
+// Same seed, same result, whatever the thread count
+void randomSortCPU(cv::Mat& img, float relEntropy, const pixSort::SortKey& key = {}, const cv::Mat& mask = cv::Mat(),
+                   uint64_t seed = 0, cv::Mat* origins = nullptr);
+// Random sort confined to tile x tile blocks, each drawn and sorted on its own
+void localRandomSortCPU(cv::Mat& img, float relEntropy, int tile, const pixSort::SortKey& key = {},
+                        const cv::Mat& mask = cv::Mat(), uint64_t seed = 0, cv::Mat* origins = nullptr);
+void imagePrint(cv::Mat& img);
+
+namespace pixSort
+{
+  // How the line sorts handled a span
+  enum class SpanPath
+  {
+    Skipped,  // already in order
+    Network,  // sorting network on 32-bit key+pixel words
+    Packed32, // radix sort of 32-bit key+pixel words
+    Packed64, // radix sort of 64-bit key+pixel words
+    Radix,    // keys and pixel indices apart
+    Count,
+  };
+
+  constexpr int spanPathCount = static_cast<int>(SpanPath::Count);
+
+  // Lines (rows, columns, angled lines, curve segments) and spans the line
+  // sorts saw, how many lines were already in order and skipped whole, and
+  // how many spans took each path
+  struct SpanStats
+  {
+    uint64_t lines = 0;
+    uint64_t skippedLines = 0;
+    uint64_t spans = 0;
+    uint64_t paths[spanPathCount] = {};
+  };
+
+  SpanStats spanStats();
+  void resetSpanStats();
+
+  // Vertical sorts normally transpose the whole image, sort its rows and
+  // transpose back, which streams the full image three times. With strips
+  // they gather, sort and scatter that many columns at a time instead, each
+  // strip on one worker, so the working set stays in L2 however tall the
+  // image is. 0 (the default) turns strips off, autoStripWidth sizes them to
+  // the L2 cache.
+  constexpr int autoStripWidth = -1;
+  void setColumnStrips(int width);
+  int columnStrips();
+}
\ No newline at end of file
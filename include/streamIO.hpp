@@ -0,0 +1,35 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace pixSort
+{
+  // The file name that stands for stdin or stdout
+  inline bool isStandardStream(const std::string& file) { return file == "-"; }
+
+  // Switches stdin and stdout to binary mode where the platform distinguishes it
+  void setBinaryStdio();
+
+  // imread flags for an encoded image starting with head. IMREAD_UNCHANGED
+  // keeps alpha and 16-bit or float depth but ignores the EXIF orientation,
+  // so JPEGs, which have neither but often an orientation, are read with
+  // IMREAD_ANYCOLOR | IMREAD_ANYDEPTH, which rotates them upright.
+  int decodeFlags(const uchar* head, size_t size);
+  int decodeFlags(const std::string& file);
+
+  // Decodes a whole encoded image read from in until end of stream, with
+  // decodeFlags. Throws std::runtime_error if it is not an image OpenCV can
+  // decode.
+  cv::Mat decodeStream(std::istream& in);
+
+  // Encodes img as the format of ext (".png") and writes it to out
+  void encodeStream(std::ostream& out, const std::string& ext, const cv::Mat& img, const std::vector<int>& params);
+
+  // Raw frames are tightly packed BGR rows without any header, as ffmpeg's
+  // rawvideo bgr24 format. readRawFrame returns false at a clean end of
+  // stream and throws std::runtime_error on a truncated frame.
+  bool readRawFrame(std::istream& in, cv::Mat& frame);
+  void writeRawFrame(std::ostream& out, const cv::Mat& frame);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+namespace pixSort
+{
+  // Pixel paths through an image, stored as flat (row * cols + col) indices.
+  // Line k owns index[offsets[k]] .. index[offsets[k+1]-1], in sorting order.
+  struct LineTable
+  {
+    std::vector<int> index;
+    std::vector<int> offsets{0};
+
+    size_t lineCount() const { return offsets.size() - 1; }
+  };
+
+  // Parallel Bresenham lines at angleDeg (counter-clockwise from the +x axis)
+  // that cover every pixel exactly once. The tables of the last few
+  // (rows, cols, angle) are kept and shared between calls.
+  std::shared_ptr<const LineTable> angleLines(int rows, int cols, float angleDeg);
+
+  enum class Curve
+  {
+    Hilbert, // generalized Hilbert curve, works for any rectangle
+    Spiral,  // clockwise from the top-left corner inwards
+    Zigzag,  // JPEG-style anti-diagonal zigzag
+  };
+
+  // A space-filling curve over the whole image cut into consecutive segments
+  // of segmentLength pixels (0 keeps the curve in one piece). The last few
+  // (curve, rows, cols, segmentLength) are cached like angleLines.
+  std::shared_ptr<const LineTable> curveLines(Curve curve, int rows, int cols, int segmentLength);
+}
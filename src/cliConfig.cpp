@@ -1,152 +1,783 @@
-#include <CLI11.hpp>
+#include "cliConfig.hpp"
 #include "sortingAlgos.hpp"
+#include "mask.hpp"
+#include "permutation.hpp"
+#include "resultCache.hpp"
+#include "streamIO.hpp"
+#include "numa.hpp"
+#include "scheduler.hpp"
+#include "perfCounters.hpp"
 
-struct Config
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+
+namespace
 {
-  enum class Mode
+  const CLI::TransformPairs<Config::Mode> mode_map
   {
-    NoMethod,
-    Horizontal,
-    Vertical,
-    RandomSort,
+    {"horizontal", Config::Mode::Horizontal},
+    {"vertical",   Config::Mode::Vertical},
+    {"random",     Config::Mode::RandomSort},
+    {"local-random", Config::Mode::LocalRandom},
+    {"angle",      Config::Mode::Angle},
+    {"hilbert",    Config::Mode::Hilbert},
+    {"spiral",     Config::Mode::Spiral},
+    {"zigzag",     Config::Mode::Zigzag}
   };
 
-  enum class ColorSpace
+  const CLI::TransformPairs<Config::ColorSpace> color_map
   {
-    NoTransformation, // BGR space
-    HSV,
-    LAB,
-    YCrCB,
+    {"HSV",  Config::ColorSpace::HSV},
+    {"LAB",  Config::ColorSpace::LAB},
+    {"YCrCb",Config::ColorSpace::YCrCB}
   };
 
-  std::string input_file;
-  std::string output_file;
-  Mode mode;
-  ColorSpace colorSpace;
-  int threshold = 0;
-  float relEntropy = 0.0f;
-  bool write = false;
-  bool transform = false;
-  
-  static constexpr int maxAbsBrightness{255+255+255};
-};
+  std::string modeName(Config::Mode mode)
+  {
+    for (const auto& entry : mode_map)
+    {
+      if (entry.second == mode) return entry.first;
+    }
+    return "none";
+  }
+
+  std::string lowercase(std::string text)
+  {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+  }
+
+  template <typename T>
+  T parseNumber(const std::string& name, const std::string& value)
+  {
+    std::istringstream in(value);
+    T number;
+    if (!(in >> number) || !in.eof())
+    {
+      throw std::invalid_argument(name + " expects a number, got '" + value + "'");
+    }
+    return number;
+  }
+
+  // Applies one name=value setting of a chain pass. Throws
+  // std::invalid_argument on unknown names and bad values.
+  void applyPassSetting(Config& config, const std::string& name, const std::string& value)
+  {
+    if (name == "t") { config.threshold = parseNumber<int>(name, value); }
+    else if (name == "e") { config.relEntropy = parseNumber<float>(name, value); }
+    else if (name == "a") { config.angle = parseNumber<float>(name, value); }
+    else if (name == "s") { config.segment = parseNumber<int>(name, value); }
+    else if (name == "seed") { config.seed = parseNumber<uint64_t>(name, value); }
+    else if (name == "tile") { config.tile = parseNumber<int>(name, value); }
+    else if (name == "k") { config.key.terms = {pixSort::parseKey(value)}; }
+    else if (name == "c")
+    {
+      std::string space = lowercase(value);
+      if (space == "bgr") { config.colorSpace = Config::ColorSpace::NoTransformation; return; }
+      for (const auto& color : color_map)
+      {
+        if (lowercase(color.first) == space) { config.colorSpace = color.second; return; }
+      }
+      throw std::invalid_argument("c expects bgr, hsv, lab or ycrcb, got '" + value + "'");
+    }
+    else
+    {
+      throw std::invalid_argument("unknown chain setting '" + name + "'");
+    }
+
+    if (config.threshold < 0 || config.threshold > Config::maxAbsBrightness || config.segment < 0 || config.tile < 1
+        || !(config.relEntropy >= 0))
+    {
+      throw std::invalid_argument(name + "=" + value + " is out of range");
+    }
+  }
+
+  // Mode of a chain pass method: h, v, r or any -m name
+  Config::Mode chainMethod(const std::string& name)
+  {
+    std::string method = lowercase(name);
+    if (method == "h") return Config::Mode::Horizontal;
+    if (method == "v") return Config::Mode::Vertical;
+    if (method == "r") return Config::Mode::RandomSort;
+    for (const auto& mode : mode_map)
+    {
+      if (mode.first == method) return mode.second;
+    }
+    return Config::Mode::NoMethod;
+  }
+
+  // Splits text on sep, but a piece for which startsNew is false is glued
+  // back onto the one before it, separator included
+  template <typename StartsNew>
+  std::vector<std::string> splitGlued(const std::string& text, char sep, StartsNew startsNew)
+  {
+    std::vector<std::string> pieces;
+    size_t begin = 0;
+    while (true)
+    {
+      size_t end = text.find(sep, begin);
+      std::string piece = text.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+      if (pieces.empty() || startsNew(piece)) { pieces.push_back(piece); }
+      else { pieces.back() += sep + piece; }
+      if (end == std::string::npos) return pieces;
+      begin = end + 1;
+    }
+  }
+
+  std::vector<std::string> split(const std::string& text, char sep)
+  {
+    return splitGlued(text, sep, [](const std::string&) { return true; });
+  }
+
+  // Parses passes like h:t=200,v:t=300,r:e=0.1. Key specs such as
+  // channel:1 and weighted:0.2,0.7,0.1 use ':' and ',' too, so a ',' only
+  // starts a pass when a method follows it and a ':' only starts a setting
+  // when a name=value follows it. ';' between passes and '/' between
+  // settings always split, e.g. h/t=200;v/k=channel:1.
+  std::vector<Config::Pass> parseChain(const std::string& text)
+  {
+    if (text.empty())
+    {
+      throw std::invalid_argument("the chain has no passes");
+    }
+    std::vector<std::string> passTexts;
+    std::vector<Config::Pass> chain;
+    auto startsPass = [](const std::string& piece)
+    {
+      return chainMethod(piece.substr(0, piece.find_first_of(":/"))) != Config::Mode::NoMethod;
+    };
+    auto startsSetting = [](const std::string& piece) { return piece.find('=') != std::string::npos; };
+
+    for (const std::string& group : split(text, ';'))
+    {
+      std::vector<std::string> passes = splitGlued(group, ',', startsPass);
+      passTexts.insert(passTexts.end(), passes.begin(), passes.end());
+    }
+
+    for (const std::string& passText : passTexts)
+    {
+      size_t methodEnd = passText.find_first_of(":/");
+      std::string method = passText.substr(0, methodEnd);
+      Config::Pass pass{chainMethod(method), {}};
+      if (pass.mode == Config::Mode::NoMethod)
+      {
+        throw std::invalid_argument("unknown method '" + method + "' in pass '" + passText + "'");
+      }
+      if (methodEnd == std::string::npos)
+      {
+        chain.push_back(pass);
+        continue;
+      }
+
+      // checked on a scratch config now, applied over the real one later
+      Config scratch{};
+      std::vector<std::string> settings;
+      for (const std::string& group : split(passText.substr(methodEnd + 1), '/'))
+      {
+        std::vector<std::string> pieces = splitGlued(group, ':', startsSetting);
+        settings.insert(settings.end(), pieces.begin(), pieces.end());
+      }
+      for (const std::string& setting : settings)
+      {
+        size_t eq = setting.find('=');
+        if (eq == std::string::npos)
+        {
+          throw std::invalid_argument("expected name=value, got '" + setting + "' in pass '" + passText + "'");
+        }
+        pass.settings.emplace_back(setting.substr(0, eq), setting.substr(eq + 1));
+        applyPassSetting(scratch, pass.settings.back().first, pass.settings.back().second);
+      }
+      chain.push_back(pass);
+    }
+    return chain;
+  }
+}
+
+// The settings of every pass: the command line alone, or each chain pass
+// applied over it
+std::vector<Config> passConfigs(const Config& config)
+{
+  if (config.chain.empty()) return {config};
+
+  std::vector<Config> passes;
+  for (const Config::Pass& pass : config.chain)
+  {
+    Config passConfig = config;
+    passConfig.chain.clear();
+    passConfig.mode = pass.mode;
+    for (const auto& setting : pass.settings) applyPassSetting(passConfig, setting.first, setting.second);
+    passes.push_back(passConfig);
+  }
+  return passes;
+}
 
 cv::Mat loadImage(const Config& config) 
 {
-    cv::Mat img = cv::imread(config.input_file, cv::IMREAD_COLOR);
+    // before decoding, so the image itself gets huge pages and its decode
+    // is profiled
+    pixSort::setHugePages(config.hugePages);
+    if (config.profile) pixSort::startPerfCounters();
+
+    // keep 16-bit and float scans at full depth and RGBA assets with their
+    // alpha, and still turn phone JPEGs upright (see decodeFlags)
+    cv::Mat img;
+    {
+        pixSort::PerfStage stage("decode");
+        if (pixSort::isStandardStream(config.input_file)) {
+            pixSort::setBinaryStdio();
+            img = pixSort::decodeStream(std::cin);
+        }
+        else {
+            img = cv::imread(config.input_file, pixSort::decodeFlags(config.input_file));
+        }
+        stage.setPixels(img.total());
+    }
     if (img.empty()) {
         throw std::runtime_error("Failed to load image from " + config.input_file);
     }
+    // replayed permutations apply to any layer as it is, e.g. 1-channel depth maps
+    if (img.channels() == 1 && config.apply_perm_file.empty()) {
+        cv::cvtColor(img, img, cv::COLOR_GRAY2BGR);
+    }
+    // the decoder touched every page from one thread, so move the rows to
+    // the nodes that will sort them
+    if (config.numa) {
+        img = pixSort::numaPlace(img);
+    }
     return img;
 }
 
 void cliSetup (CLI::App& app, Config& config)
 {
-  app.add_option("-i,--input", config.input_file, "Input image file")
+  app.add_option("-i,--input", config.input_file, "Input image file, - for stdin")
         ->required()
-        ->check(CLI::ExistingFile);
-  app.add_option("-o,--output", config.output_file, "Output image file")
+        ->check(CLI::ExistingFile | CLI::IsMember({"-"}));
+  app.add_option("-o,--output", config.output_file, "Output image file, - for stdout")
         ->required();
+  app.add_option("--format", config.format, "Image format written to stdout, e.g. png, jpg, webp");
   
-  CLI::TransformPairs<Config::Mode> mode_map
-  {
-    {"horizontal", Config::Mode::Horizontal},
-    {"vertical",   Config::Mode::Vertical},
-    {"random",     Config::Mode::RandomSort}
-  };
-  app.add_option("-m, --method", config.mode, "Sorting method")
-        ->required()
+  auto method = app.add_option("-m, --method", config.mode, "Sorting method (required unless --apply-perm or --chain is given)")
        ->transform(CLI::Transformer(mode_map, CLI::ignore_case));
+  auto chain = app.add_option_function<std::string>("--chain", [&config](const std::string& text)
+  {
+    try { config.chain = parseChain(text); }
+    catch (const std::invalid_argument& e) { throw CLI::ValidationError("--chain", e.what()); }
+  }, "Run several passes, e.g. h:t=200,v:t=300:k=channel:1,r:e=0.1 (settings: t e a s seed tile k c)")
+       ->excludes(method);
   
-  CLI::TransformPairs<Config::ColorSpace> color_map
+  auto color = app.add_option("-c, --color", config.colorSpace, "Select color space")
+       ->transform(CLI::Transformer(color_map, CLI::ignore_case));
+
+  app.add_option_function<std::vector<std::string>>("-k,--key", [&config](const std::vector<std::string>& texts)
   {
-    {"HSV",  Config::ColorSpace::HSV},
-    {"LAB",  Config::ColorSpace::LAB},
-    {"YCrCb",Config::ColorSpace::YCrCB}
+    config.key.terms.clear();
+    for (const std::string& text : texts)
+    {
+      try { config.key.terms.push_back(pixSort::parseKey(text)); }
+      catch (const std::invalid_argument& e) { throw CLI::ValidationError("--key", e.what()); }
+    }
+  }, "Sort keys, later ones break ties: brightness|hue|sat|value|luma|channel:N|max|min|weighted:w0,w1,w2");
+
+  CLI::TransformPairs<pixSort::SortOrder> order_map
+  {
+    {"asc",     pixSort::SortOrder::Ascending},
+    {"desc",    pixSort::SortOrder::Descending},
+    {"reverse", pixSort::SortOrder::Reverse}
   };
-  app.add_option("-c, --color", config.colorSpace, "Select color space")
-       ->transform(CLI::Transformer(color_map, CLI::ignore_case));
+  app.add_option("--order", config.key.order, "Sort order")
+       ->transform(CLI::Transformer(order_map, CLI::ignore_case));
+
+  CLI::TransformPairs<pixSort::SortEngine> engine_map
+  {
+    {"radix",  pixSort::SortEngine::Radix},
+    {"packed", pixSort::SortEngine::Packed},
+    {"network", pixSort::SortEngine::Network}
+  };
+  app.add_option("--engine", config.key.engine, "Sort engine")
+       ->transform(CLI::Transformer(engine_map, CLI::ignore_case));
 
   app.add_option("-t,--treshold", config.threshold, "Use threshold on brightness with sort")
         ->expected(0, config.maxAbsBrightness)
         ->check(CLI::Range(0, config.maxAbsBrightness));
   app.add_option("-e,--entropy", config.relEntropy, "set relative entropy for the random sort")
-        ->expected(0, 1);
+        ->expected(0, 1)
+        ->check(CLI::NonNegativeNumber);
+  app.add_option("--seed", config.seed, "Seed for the random sort");
+  app.add_option("--tile", config.tile, "Tile size in pixels for the local random sort")
+        ->check(CLI::PositiveNumber);
+  app.add_option("-a,--angle", config.angle, "Line angle in degrees for the angle sort");
+  app.add_option("-s,--segment", config.segment, "Segment length in pixels for curve sorts (0 = whole curve)")
+        ->check(CLI::NonNegativeNumber);
+
+  auto maskFile = app.add_option("--mask", config.mask_file, "Only sort where this mask image is non-zero")
+        ->check(CLI::ExistingFile);
+  CLI::TransformPairs<Config::MaskSource> mask_map
+  {
+    {"brightness", Config::MaskSource::Brightness},
+    {"edges",      Config::MaskSource::Edges},
+    {"saturation", Config::MaskSource::Saturation}
+  };
+  auto maskGen = app.add_option("--mask-gen", config.maskSource, "Compute the mask from the input image")
+       ->transform(CLI::Transformer(mask_map, CLI::ignore_case))
+       ->excludes(maskFile);
+  auto alphaMask = app.add_flag("--alpha-mask", config.alphaMask, "Only sort pixels that are not fully transparent")
+       ->excludes(maskFile);
+  app.add_option("--mask-low", config.maskLow, "Lower bound of the generated mask band (Canny low threshold for edges)")
+        ->check(CLI::Range(0, 255));
+  app.add_option("--mask-high", config.maskHigh, "Upper bound of the generated mask band (Canny high threshold for edges)")
+        ->check(CLI::Range(0, 255));
+
+  CLI::TransformPairs<pixSort::CpuLevel> isa_map
+  {
+    {"auto",     pixSort::CpuLevel::Auto},
+    {"baseline", pixSort::CpuLevel::Baseline},
+    {"sse4.2",   pixSort::CpuLevel::SSE42},
+    {"avx2",     pixSort::CpuLevel::AVX2},
+    {"avx512",   pixSort::CpuLevel::AVX512},
+    {"neon",     pixSort::CpuLevel::NEON}
+  };
+  app.add_option("--isa", config.isa, "Instruction set for the sort kernels (default: best the CPU supports)")
+       ->transform(CLI::Transformer(isa_map, CLI::ignore_case));
+  app.add_flag("--profile", config.profile, "Print where the time went to stderr after the run");
+  app.add_flag("--numa", config.numa, "Keep row bands on the NUMA node of the pinned threads that sort them");
+  auto strips = app.add_flag("--strips", config.strips, "Sort columns in strips that fit in L2 instead of transposing the whole image");
+  app.add_option("--strip-width", config.stripWidth, "Columns per strip (default: sized to the L2 cache)")
+        ->check(CLI::PositiveNumber)
+        ->needs(strips);
+
+  CLI::TransformPairs<pixSort::HugePageMode> huge_page_map
+  {
+    {"off",      pixSort::HugePageMode::Off},
+    {"thp",      pixSort::HugePageMode::Transparent},
+    {"explicit", pixSort::HugePageMode::Explicit}
+  };
+  app.add_option("--huge-pages", config.hugePages, "Back large images and scratch buffers with huge pages, falling back to plain ones")
+       ->transform(CLI::Transformer(huge_page_map, CLI::ignore_case));
+
+  auto savePerm = app.add_option("--save-perm", config.save_perm_file, "Write the permutation the sort applied to this file");
+  auto applyPerm = app.add_option("--apply-perm", config.apply_perm_file, "Apply a saved permutation to the input instead of sorting it")
+       ->check(CLI::ExistingFile)
+       ->excludes(method)
+       ->excludes(chain)
+       ->excludes(color)
+       ->excludes(maskFile)
+       ->excludes(maskGen)
+       ->excludes(alphaMask)
+       ->excludes(savePerm);
+
+  auto cacheDir = app.add_option("--cache", config.cache_dir, "Reuse results of earlier runs with the same input and settings from this directory");
+  app.add_option("--cache-size", config.cacheSize, "Cache size limit in MiB, least recently used results are evicted first")
+        ->check(CLI::PositiveNumber);
+  app.add_flag("--cache-stats", config.cacheStats, "Print cache hits, misses and size after the run");
+
+  app.add_option("--png-level", config.encode.pngLevel, "PNG compression level, 0 (fastest) to 9 (smallest)")
+        ->check(CLI::Range(0, 9));
+  app.add_option("--jpeg-quality", config.encode.jpegQuality, "JPEG quality, 0-100")
+        ->check(CLI::Range(0, 100));
+  app.add_option("--webp-quality", config.encode.webpQuality, "WebP quality, 1-100, above 100 is lossless")
+        ->check(CLI::Range(1, 101));
+  app.add_flag("--fast-encode", config.encode.fast, "Favor encode speed over file size (PNG level 1 unless --png-level is set)");
+
+  app.add_option_function<std::string>("--raw", [&config](const std::string& size)
+  {
+    char x = 0, rest = 0;
+    if (std::sscanf(size.c_str(), "%d%c%d%c", &config.rawWidth, &x, &config.rawHeight, &rest) != 3
+        || (x != 'x' && x != 'X') || config.rawWidth <= 0 || config.rawHeight <= 0)
+    {
+      throw CLI::ValidationError("--raw", "expects the frame size as WxH");
+    }
+  }, "Sort a stream of raw 8-bit BGR frames of this size (WxH), e.g. ffmpeg's rawvideo bgr24, always written to the output")
+       ->excludes(savePerm)
+       ->excludes(cacheDir);
+
   app.add_flag("-w,--write", config.write, "Write result to output file");
   app.add_flag("-x,--transform", config.transform, "Stay in the transformation space");
+  app.add_flag("--no-display", config.noDisplay, "Do not show the result in a window");
+
+  app.final_callback([method, chain, applyPerm]
+  {
+    if (method->count() == 0 && chain->count() == 0 && applyPerm->count() == 0)
+    {
+      throw CLI::RequiredError("--method (or --chain or --apply-perm)");
+    }
+  });
 }
 
-void transformImage(cv::Mat& img, Config& config)
+// cvtColor drops alpha, so 4-channel images convert their BGR part only
+void convertColor(cv::Mat& img, int code)
 {
-  switch (config.colorSpace)
+  if (img.channels() != 4)
+  {
+    cv::cvtColor(img, img, code);
+    return;
+  }
+  cv::Mat bgr, alpha;
+  cv::cvtColor(img, bgr, cv::COLOR_BGRA2BGR);
+  cv::extractChannel(img, alpha, 3);
+  cv::cvtColor(bgr, bgr, code);
+  cv::merge(std::vector<cv::Mat>{bgr, alpha}, img);
+}
+
+void transformImage(cv::Mat& img, Config::ColorSpace colorSpace)
+{
+  // OpenCV only converts 8-bit and float images to HSV and LAB, so 16-bit
+  // ones go through float in [0, 1]; inverseTransformImage brings them back
+  if (img.depth() == CV_16U &&
+      (colorSpace == Config::ColorSpace::HSV || colorSpace == Config::ColorSpace::LAB))
+  {
+    img.convertTo(img, CV_32F, 1.0 / 65535);
+  }
+
+  switch (colorSpace)
   {
   case Config::ColorSpace::HSV:
-    cv::cvtColor(img, img, cv::COLOR_BGR2HSV);
+    convertColor(img, cv::COLOR_BGR2HSV);
     break;
   case Config::ColorSpace::LAB:
-    cv::cvtColor(img, img, cv::COLOR_BGR2Lab);
+    convertColor(img, cv::COLOR_BGR2Lab);
     break;
   case Config::ColorSpace::YCrCB:
-    cv::cvtColor(img, img, cv::COLOR_BGR2YCrCb);
+    convertColor(img, cv::COLOR_BGR2YCrCb);
     break;  
   default: // does nothing as the image is already BGR
     break;
   }
 }
 
-void inverseTransformImage(cv::Mat& img, Config& config)
+// Back to BGR at depth, the depth the image had before transformImage
+void inverseTransformImage(cv::Mat& img, Config::ColorSpace colorSpace, int depth)
 {
-  switch (config.colorSpace)
+  switch (colorSpace)
   {
   case Config::ColorSpace::HSV:
-    cv::cvtColor(img, img, cv::COLOR_HSV2BGR);
+    convertColor(img, cv::COLOR_HSV2BGR);
     break;
   case Config::ColorSpace::LAB:
-    cv::cvtColor(img, img, cv::COLOR_Lab2BGR);
+    convertColor(img, cv::COLOR_Lab2BGR);
     break;
   case Config::ColorSpace::YCrCB:
-    cv::cvtColor(img, img, cv::COLOR_YCrCb2BGR);
+    convertColor(img, cv::COLOR_YCrCb2BGR);
     break;  
   default: // does nothing as the image is already BGR
     break;
   }
+  if (img.depth() == CV_32F && depth == CV_16U)
+  {
+    img.convertTo(img, CV_16U, 65535);
+  }
 }
 
-void applyImageProcessing(cv::Mat& img, Config& config)
+// Inputs read from files, which stay the same for every frame of a stream
+struct FileInputs
 {
-  transformImage(img, config);
+  cv::Mat mask;        // --mask, at the image size
+  cv::Mat permutation; // --apply-perm
+};
+
+FileInputs loadFileInputs(const Config& config, cv::Size size)
+{
+  FileInputs inputs;
+  if (!config.apply_perm_file.empty())
+  {
+    pixSort::PerfStage stage("apply permutation", size.area());
+    inputs.permutation = pixSort::loadPermutation(config.apply_perm_file);
+  }
+  else if (!config.mask_file.empty())
+  {
+    pixSort::PerfStage stage("mask", size.area());
+    inputs.mask = pixSort::loadMask(config.mask_file, size);
+  }
+  return inputs;
+}
+
+cv::Mat buildMask(const cv::Mat& img, const Config& config, const FileInputs& inputs)
+{
+  if (config.alphaMask)
+  {
+    if (img.channels() != 4)
+    {
+      throw std::runtime_error("--alpha-mask needs an image with an alpha channel.\n");
+    }
+    cv::Mat alpha, mask;
+    cv::extractChannel(img, alpha, 3);
+    cv::compare(alpha, 0, mask, cv::CMP_GT);
+    return mask;
+  }
+
+  if (!config.mask_file.empty())
+  {
+    return inputs.mask;
+  }
+
+  switch (config.maskSource)
+  {
+  case Config::MaskSource::Brightness:
+    return pixSort::brightnessMask(img, config.maskLow, config.maskHigh);
+  case Config::MaskSource::Edges:
+    return pixSort::edgeMask(img, config.maskLow, config.maskHigh);
+  case Config::MaskSource::Saturation:
+    return pixSort::saturationMask(img, config.maskLow, config.maskHigh);
+  default: // no mask, sort everything
+    return cv::Mat();
+  }
+}
 
+void sortPass(cv::Mat& img, const Config& config, const cv::Mat& mask, cv::Mat* record)
+{
   switch (config.mode)
   {
   case Config::Mode::Horizontal:
-    if (config.threshold >0) {sortByRowThresholdCPU(img, config.threshold);}
-    else {sortByRowThresholdCPU(img, 0);}
+    if (config.threshold >0) {sortByRowThresholdCPU(img, config.threshold, config.key, mask, record);}
+    else {sortByRowThresholdCPU(img, 0, config.key, mask, record);}
     break;
   case Config::Mode::Vertical:
-    if (config.threshold >0) {sortByColumnThresholdCPU(img, config.threshold);}
-    else {sortByColumnThresholdCPU(img, 0);}
+    if (config.threshold >0) {sortByColumnThresholdCPU(img, config.threshold, config.key, mask, record);}
+    else {sortByColumnThresholdCPU(img, 0, config.key, mask, record);}
+    break;
+  case Config::Mode::Angle:
+    sortByAngleThresholdCPU(img, config.threshold, config.angle, config.key, mask, record);
+    break;
+  case Config::Mode::Hilbert:
+    sortByCurveThresholdCPU(img, config.threshold, pixSort::Curve::Hilbert, config.segment, config.key, mask, record);
+    break;
+  case Config::Mode::Spiral:
+    sortByCurveThresholdCPU(img, config.threshold, pixSort::Curve::Spiral, config.segment, config.key, mask, record);
+    break;
+  case Config::Mode::Zigzag:
+    sortByCurveThresholdCPU(img, config.threshold, pixSort::Curve::Zigzag, config.segment, config.key, mask, record);
     break;
   case Config::Mode::RandomSort:
-       if (config.relEntropy >= 0){randomSortCPU(img, config.relEntropy);}
+       if (config.relEntropy >= 0){randomSortCPU(img, config.relEntropy, config.key, mask, config.seed, record);}
+       break;
+  case Config::Mode::LocalRandom:
+       if (config.relEntropy >= 0){localRandomSortCPU(img, config.relEntropy, config.tile, config.key, mask, config.seed, record);}
        break;
   default: 
        throw std::runtime_error("Sorting method not specified.\n");
        break;
   }
+}
 
-  if (config.write)
+// Runs every pass and returns the color space the image is left in
+Config::ColorSpace sortImage(cv::Mat& img, Config& config, const FileInputs& inputs)
+{
+  // masks are always computed on the BGR input
+  cv::Mat mask;
   {
-    if (config.output_file.empty())
+    pixSort::PerfStage stage("mask", img.total());
+    mask = buildMask(img, config, inputs);
+  }
+
+  cv::Mat origins;
+  if (!config.save_perm_file.empty())
+  {
+    origins = pixSort::identityOrigins(img.rows, img.cols);
+  }
+  cv::Mat* record = origins.empty() ? nullptr : &origins;
+
+  // passes in the same color space share it without converting in between
+  Config::ColorSpace space = Config::ColorSpace::NoTransformation;
+  int depth = img.depth();
+  for (const Config& pass : passConfigs(config))
+  {
+    if (pass.colorSpace != space)
+    {
+      pixSort::PerfStage stage("convert", img.total());
+      inverseTransformImage(img, space, depth);
+      transformImage(img, pass.colorSpace);
+      space = pass.colorSpace;
+    }
+    pixSort::PerfStage stage("sort " + modeName(pass.mode), img.total());
+    sortPass(img, pass, mask, record);
+  }
+
+  if (record)
+  {
+    pixSort::PerfStage stage("save permutation", img.total());
+    pixSort::savePermutation(config.save_perm_file, origins);
+  }
+  return space;
+}
+
+// A window needs a display server; on X11 and Wayland systems it is named in
+// the environment
+bool displayAvailable()
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+  return std::getenv("DISPLAY") || std::getenv("WAYLAND_DISPLAY");
+#else
+  return true;
+#endif
+}
+
+void printCacheStats(const pixSort::ResultCache& cache)
+{
+  pixSort::CacheStats stats = cache.stats();
+  std::cout << "cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions
+            << " evictions, " << stats.entries << " entries, " << std::fixed << std::setprecision(1)
+            << stats.bytes / 1048576.0 << " MiB\n";
+}
+
+// Everything the written output depends on, with settings the mode ignores
+// left out so equivalent runs share a cache entry. The CPU level is left out
+// as every level gives the same result.
+uint64_t cacheKey(const cv::Mat& img, const Config& config)
+{
+  std::ostringstream key;
+  key << std::setprecision(9) << "pixSort-cache 2|" << std::filesystem::path(config.output_file).extension().string();
+  for (int param : pixSort::encodeParams(config.encode, config.output_file)) key << ' ' << param;
+
+  if (!config.apply_perm_file.empty())
+  {
+    key << "|perm " << pixSort::hashFile(config.apply_perm_file);
+    return pixSort::xxHash64(key.str().data(), key.str().size(), pixSort::hashImage(img));
+  }
+
+  key << "|x " << config.transform;
+  for (const Config& pass : passConfigs(config))
+  {
+    key << "|mode " << int(pass.mode) << "|color " << int(pass.colorSpace);
+    key << "|order " << int(pass.key.order);
+    // Radix and Packed give the same result
+    key << "|engine " << (pass.key.engine == pixSort::SortEngine::Network);
+    for (const pixSort::KeySpec& term : pass.key.terms)
     {
-      throw std::runtime_error("Output file not specified.\n");
+      key << "|key " << int(term.kind);
+      if (term.kind == pixSort::KeySpec::Kind::Channel) key << ':' << term.channel;
+      if (term.kind == pixSort::KeySpec::Kind::Weighted)
+      {
+        key << ':' << term.weights[0] << ',' << term.weights[1] << ',' << term.weights[2];
+      }
     }
-    cv::imwrite(config.output_file, img);
+
+    switch (pass.mode)
+    {
+    case Config::Mode::RandomSort:
+      key << "|entropy " << pass.relEntropy << "|seed " << pass.seed;
+      break;
+    case Config::Mode::LocalRandom:
+      key << "|entropy " << pass.relEntropy << "|seed " << pass.seed << "|tile " << pass.tile;
+      break;
+    case Config::Mode::Angle:
+      key << "|threshold " << pass.threshold << "|angle " << pass.angle;
+      break;
+    case Config::Mode::Hilbert:
+    case Config::Mode::Spiral:
+    case Config::Mode::Zigzag:
+      key << "|threshold " << pass.threshold << "|segment " << pass.segment;
+      break;
+    default:
+      key << "|threshold " << pass.threshold;
+      break;
+    }
+  }
+
+  if (config.alphaMask) { key << "|alpha-mask"; }
+  else if (!config.mask_file.empty()) { key << "|mask " << pixSort::hashFile(config.mask_file); }
+  else if (config.maskSource != Config::MaskSource::None)
+  {
+    key << "|mask-gen " << int(config.maskSource) << ' ' << config.maskLow << ' ' << config.maskHigh;
+  }
+  return pixSort::xxHash64(key.str().data(), key.str().size(), pixSort::hashImage(img));
+}
+
+// Sorts img, or replays a permutation on it, and converts the result back
+// to BGR if it is consumed and -x is not given
+void processImage(cv::Mat& img, Config& config, bool consumed, const FileInputs& inputs)
+{
+  // replaying a permutation is a pure gather, nothing is sorted
+  Config::ColorSpace space = Config::ColorSpace::NoTransformation;
+  int depth = img.depth();
+  if (!config.apply_perm_file.empty())
+  {
+    pixSort::PerfStage stage("apply permutation", img.total());
+    img = pixSort::applyPermutation(img, inputs.permutation);
+  }
+  else
+  {
+    space = sortImage(img, config, inputs);
+  }
+
+  if (!config.transform && consumed && space != Config::ColorSpace::NoTransformation)
+  {
+    pixSort::PerfStage stage("convert", img.total());
+    inverseTransformImage(img, space, depth);
+  }
+}
+
+// The name whose extension picks the output format
+std::string encodedName(const Config& config)
+{
+  return pixSort::isStandardStream(config.output_file) ? "." + config.format : config.output_file;
+}
+
+std::future<void> applyImageProcessing(cv::Mat& img, Config& config)
+{
+  pixSort::setCpuLevel(config.isa);
+  pixSort::setNumaPlacement(config.numa);
+  pixSort::setColumnStrips(config.strips ? (config.stripWidth > 0 ? config.stripWidth : pixSort::autoStripWidth) : 0);
+  if (config.profile) pixSort::startPerfCounters();
+
+  if (config.write && config.output_file.empty())
+  {
+    throw std::runtime_error("Output file not specified.\n");
   }
 
-  if (!config.transform)
+  // only written results are cached, and recording a permutation needs the sort
+  std::optional<pixSort::ResultCache> cache;
+  uint64_t key = 0;
+  if (!config.cache_dir.empty() && config.write && config.save_perm_file.empty()
+      && !pixSort::isStandardStream(config.output_file))
+  {
+    cache.emplace(config.cache_dir, uint64_t(config.cacheSize) << 20);
+    key = cacheKey(img, config);
+  }
+
+  // the result only goes back to BGR when something consumes it
+  config.noDisplay = config.noDisplay || !displayAvailable();
+  bool consumed = config.write || !config.noDisplay;
+
+  std::future<void> written;
+  if (cache && cache->fetch(key, config.output_file))
+  {
+    if (!config.noDisplay) img = cv::imread(config.output_file, cv::IMREAD_UNCHANGED);
+    if (config.cacheStats) printCacheStats(*cache);
+    return written;
+  }
+
+  processImage(img, config, consumed, loadFileInputs(config, img.size()));
+
+  if (config.write)
   {
-    inverseTransformImage(img, config);
+    // a cache hit may have left the output hard linked to an entry
+    std::error_code error;
+    if (!pixSort::isStandardStream(config.output_file)) std::filesystem::remove(config.output_file, error);
+
+    // encoding is off the critical path; the encoder shares img's buffer,
+    // which nothing modifies from here on
+    written = std::async(std::launch::async,
+      [file = config.output_file, name = encodedName(config), params = pixSort::encodeParams(config.encode, encodedName(config)),
+       sorted = img, cache, key, printStats = config.cacheStats]() mutable
+    {
+      if (pixSort::isStandardStream(file))
+      {
+        pixSort::setBinaryStdio();
+        pixSort::encodeStream(std::cout, name, sorted, params);
+        return;
+      }
+      pixSort::writeImage(file, sorted, params);
+      if (!cache) return;
+      cache->store(key, file);
+      if (printStats) printCacheStats(*cache);
+    });
   }
+  return written;
 }
 
 void displayImage(cv::Mat& img)
@@ -155,3 +786,98 @@ void displayImage(cv::Mat& img)
   cv::imshow("Display Image", img);
   cv::waitKey(0);
 }
+
+void processRawFrames(Config& config)
+{
+  pixSort::setCpuLevel(config.isa);
+  pixSort::setNumaPlacement(config.numa);
+  pixSort::setHugePages(config.hugePages);
+  pixSort::setColumnStrips(config.strips ? (config.stripWidth > 0 ? config.stripWidth : pixSort::autoStripWidth) : 0);
+  if (config.profile) pixSort::startPerfCounters();
+  pixSort::setBinaryStdio();
+
+  std::ifstream inFile;
+  std::ofstream outFile;
+  if (!pixSort::isStandardStream(config.input_file)) inFile.open(config.input_file, std::ios::binary);
+  if (!pixSort::isStandardStream(config.output_file)) outFile.open(config.output_file, std::ios::binary);
+  std::istream& in = inFile.is_open() ? inFile : std::cin;
+  std::ostream& out = outFile.is_open() ? outFile : std::cout;
+  if (!in || !out)
+  {
+    throw std::runtime_error("Failed to open the raw frame streams.\n");
+  }
+
+  // two frames in flight: one is sorted while the previous one is written
+  cv::Mat frames[2] = {cv::Mat(config.rawHeight, config.rawWidth, CV_8UC3, cv::Scalar::all(0)),
+                       cv::Mat(config.rawHeight, config.rawWidth, CV_8UC3, cv::Scalar::all(0))};
+  if (config.numa)
+  {
+    for (cv::Mat& frame : frames) frame = pixSort::numaPlace(frame);
+  }
+  FileInputs inputs = loadFileInputs(config, frames[0].size());
+  std::future<void> written;
+  for (size_t i = 0; pixSort::readRawFrame(in, frames[i % 2]); ++i)
+  {
+    cv::Mat& frame = frames[i % 2];
+    processImage(frame, config, true, inputs);
+    if (written.valid()) written.get();
+    written = std::async(std::launch::async, [&out, frame] { pixSort::writeRawFrame(out, frame); });
+  }
+  if (written.valid()) written.get();
+  out.flush();
+}
+
+void printProfile(const Config& config)
+{
+  if (!config.profile) return;
+
+  std::vector<pixSort::WorkerStats> workers = pixSort::schedulerStats();
+  std::fprintf(stderr, "scheduler (%d threads)\n", cv::getNumThreads());
+  std::fprintf(stderr, "%8s %8s %8s %10s %10s\n", "worker", "chunks", "steals", "busy ms", "idle ms");
+  for (size_t w = 0; w < workers.size(); ++w)
+  {
+    const pixSort::WorkerStats& worker = workers[w];
+    std::fprintf(stderr, "%8zu %8llu %8llu %10.2f %10.2f\n", w, static_cast<unsigned long long>(worker.chunks),
+                 static_cast<unsigned long long>(worker.steals), worker.busyMs, worker.idleMs);
+  }
+
+  pixSort::HugePageStats pages = pixSort::hugePageStats();
+  std::fprintf(stderr, "large buffers: %.1f MiB explicit huge pages, %.1f MiB transparent, %.1f MiB plain\n",
+               pages.explicitBytes / 1048576.0, pages.transparentBytes / 1048576.0, pages.plainBytes / 1048576.0);
+
+  // every stage, summed over the frames, with its counts per pixel
+  std::vector<pixSort::StageCounts> stages = pixSort::perfStages();
+  std::string reason = pixSort::perfUnavailableReason();
+  std::fprintf(stderr, "stages%s%s\n", reason.empty() ? "" : ", not counted: ", reason.c_str());
+  std::fprintf(stderr, "%-20s %6s %10s %12s", "stage", "runs", "ms", "pixels");
+  for (int e = 0; e < pixSort::perfEventCount; ++e)
+  {
+    std::fprintf(stderr, " %16s", (pixSort::perfEventName(pixSort::PerfEvent(e)) + std::string("/px")).c_str());
+  }
+  std::fprintf(stderr, " %6s\n", "IPC");
+  for (const pixSort::StageCounts& stage : stages)
+  {
+    std::fprintf(stderr, "%-20s %6llu %10.2f %12llu", stage.name.c_str(), static_cast<unsigned long long>(stage.runs), stage.ms,
+                 static_cast<unsigned long long>(stage.pixels));
+    for (int e = 0; e < pixSort::perfEventCount; ++e)
+    {
+      if (stage.counted[e] && stage.pixels > 0) { std::fprintf(stderr, " %16.4f", double(stage.values[e]) / stage.pixels); }
+      else { std::fprintf(stderr, " %16s", "-"); }
+    }
+    int cycles = int(pixSort::PerfEvent::Cycles), instructions = int(pixSort::PerfEvent::Instructions);
+    if (stage.counted[cycles] && stage.counted[instructions] && stage.values[cycles] > 0)
+    {
+      std::fprintf(stderr, " %6.2f\n", double(stage.values[instructions]) / stage.values[cycles]);
+    }
+    else { std::fprintf(stderr, " %6s\n", "-"); }
+  }
+
+  pixSort::SpanStats spans = pixSort::spanStats();
+  auto path = [&](pixSort::SpanPath p) { return static_cast<unsigned long long>(spans.paths[int(p)]); };
+  std::fprintf(stderr, "skipped %llu of %llu lines, %llu of %llu spans, already in order\n",
+               static_cast<unsigned long long>(spans.skippedLines), static_cast<unsigned long long>(spans.lines),
+               path(pixSort::SpanPath::Skipped), static_cast<unsigned long long>(spans.spans));
+  std::fprintf(stderr, "sorted spans: %llu network, %llu packed 32-bit, %llu packed 64-bit, %llu radix\n",
+               path(pixSort::SpanPath::Network), path(pixSort::SpanPath::Packed32), path(pixSort::SpanPath::Packed64),
+               path(pixSort::SpanPath::Radix));
+}
@@ -0,0 +1,102 @@
+#include "cpuFeatures.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace pixSort
+{
+  namespace
+  {
+    CpuLevel detectLevel()
+    {
+#if defined(PIXSORT_X86_DISPATCH)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+          && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq")
+          && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+      {
+        return CpuLevel::AVX512;
+      }
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+      {
+        return CpuLevel::AVX2;
+      }
+      if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+      {
+        return CpuLevel::SSE42;
+      }
+#elif defined(PIXSORT_NEON)
+      return CpuLevel::NEON;
+#endif
+      return CpuLevel::Baseline;
+    }
+
+    CpuLevel detectedLevel()
+    {
+      static const CpuLevel detected = detectLevel();
+      return detected;
+    }
+
+    // Whether code built for level runs on a CPU detected as `detected`
+    bool supports(CpuLevel detected, CpuLevel level)
+    {
+      if (level == CpuLevel::Baseline || level == detected) return true;
+      if (detected == CpuLevel::NEON || level == CpuLevel::NEON) return false;
+      return static_cast<int>(level) <= static_cast<int>(detected);
+    }
+
+    std::atomic<CpuLevel> active{CpuLevel::Auto};
+  }
+
+  CpuLevel cpuLevel()
+  {
+    CpuLevel level = active.load(std::memory_order_relaxed);
+    return level == CpuLevel::Auto ? detectedLevel() : level;
+  }
+
+  void setCpuLevel(CpuLevel level)
+  {
+    if (level != CpuLevel::Auto && !supports(detectedLevel(), level))
+    {
+      throw std::runtime_error(std::string("This CPU does not support ") + cpuLevelName(level)
+                               + ", the best available is " + cpuLevelName(detectedLevel()) + ".\n");
+    }
+    active.store(level, std::memory_order_relaxed);
+  }
+
+  const char* cpuLevelName(CpuLevel level)
+  {
+    switch (level)
+    {
+    case CpuLevel::Baseline: return "baseline";
+    case CpuLevel::SSE42: return "sse4.2";
+    case CpuLevel::AVX2: return "avx2";
+    case CpuLevel::AVX512: return "avx512";
+    case CpuLevel::NEON: return "neon";
+    default: return "auto";
+    }
+  }
+
+  size_t l2CacheBytes()
+  {
+    static const size_t bytes = []
+    {
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+      long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+      if (size > 0) return static_cast<size_t>(size);
+#endif
+      // glibc reports 0 on some CPUs (and all of aarch64), sysfs still knows
+      std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index2/size");
+      size_t kib = 0;
+      char unit = 0;
+      if (file >> kib >> unit && unit == 'K') return kib * 1024;
+      return size_t(1) << 20;
+    }();
+    return bytes;
+  }
+}
@@ -0,0 +1,155 @@
+#include "hugePages.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace pixSort
+{
+  namespace
+  {
+    std::atomic<HugePageMode> mode{HugePageMode::Off};
+    std::atomic<uint64_t> explicitBytes{0}, transparentBytes{0}, plainBytes{0};
+
+    size_t mappedSize(size_t bytes) { return (bytes + hugePageSize - 1) / hugePageSize * hugePageSize; }
+
+#if defined(__linux__)
+    // Anonymous mapping of size bytes that starts on a hugePageSize boundary:
+    // map one huge page more and cut off the ends
+    void* mapAligned(size_t size)
+    {
+      void* raw = mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) return nullptr;
+      uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+      uintptr_t aligned = (start + hugePageSize - 1) / hugePageSize * hugePageSize;
+      if (aligned > start) munmap(raw, aligned - start);
+      munmap(reinterpret_cast<void*>(aligned + size), start + hugePageSize - aligned);
+      return reinterpret_cast<void*>(aligned);
+    }
+#endif
+
+    // Huge page Mats, small ones are left to OpenCV's own allocator
+    class HugePageMatAllocator : public cv::MatAllocator
+    {
+    public:
+      cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag flags,
+                             cv::UMatUsageFlags usageFlags) const override
+      {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; --i)
+        {
+          if (step)
+          {
+            if (data0 && step[i] != CV_AUTOSTEP) { total = step[i]; }
+            else { step[i] = total; }
+          }
+          total *= sizes[i];
+        }
+        if (data0 || total < hugePageSize)
+        {
+          return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+        }
+
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = static_cast<uchar*>(hugeAllocate(total));
+        u->size = total;
+        return u;
+      }
+
+      bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const override
+      {
+        return u != nullptr;
+      }
+
+      void deallocate(cv::UMatData* u) const override
+      {
+        if (!u) return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        hugeDeallocate(u->origdata, u->size);
+        delete u;
+      }
+    };
+
+    HugePageMatAllocator matAllocator;
+  }
+
+  HugePageMode hugePageMode()
+  {
+    return mode.load(std::memory_order_relaxed);
+  }
+
+  void setHugePages(HugePageMode newMode)
+  {
+    mode.store(newMode, std::memory_order_relaxed);
+    // Mats keep the allocator that made them, so switching is safe any time
+    cv::Mat::setDefaultAllocator(newMode == HugePageMode::Off ? nullptr : &matAllocator);
+  }
+
+  void* hugeAllocate(size_t bytes)
+  {
+#if defined(__linux__)
+    if (bytes >= hugePageSize)
+    {
+      size_t size = mappedSize(bytes);
+      HugePageMode current = hugePageMode();
+#if defined(MAP_HUGETLB)
+      if (current == HugePageMode::Explicit)
+      {
+        // fails when the pool (vm.nr_hugepages) is empty, as in most containers
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+          explicitBytes.fetch_add(size, std::memory_order_relaxed);
+          return data;
+        }
+      }
+#endif
+      void* data = mapAligned(size);
+      if (!data) throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+      // only advice: fails quietly without THP, the pages stay plain then
+      if (current != HugePageMode::Off && madvise(data, size, MADV_HUGEPAGE) == 0)
+      {
+        transparentBytes.fetch_add(size, std::memory_order_relaxed);
+        return data;
+      }
+#endif
+      plainBytes.fetch_add(size, std::memory_order_relaxed);
+      return data;
+    }
+#endif
+    void* data = std::malloc(bytes ? bytes : 1);
+    if (!data) throw std::bad_alloc();
+    return data;
+  }
+
+  void hugeDeallocate(void* data, size_t bytes)
+  {
+    if (!data) return;
+#if defined(__linux__)
+    // explicit and transparent mappings alike are unmapped whole
+    if (bytes >= hugePageSize)
+    {
+      munmap(data, mappedSize(bytes));
+      return;
+    }
+#endif
+    (void)bytes;
+    std::free(data);
+  }
+
+  HugePageStats hugePageStats()
+  {
+    return {explicitBytes.load(), transparentBytes.load(), plainBytes.load()};
+  }
+
+  void resetHugePageStats()
+  {
+    explicitBytes = 0;
+    transparentBytes = 0;
+    plainBytes = 0;
+  }
+}
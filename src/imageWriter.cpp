@@ -0,0 +1,52 @@
+#include "imageWriter.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace pixSort
+{
+  namespace
+  {
+    std::string extension(const std::string& file)
+    {
+      size_t dot = file.find_last_of('.');
+      if (dot == std::string::npos || file.find_first_of("/\\", dot) != std::string::npos) return "";
+      std::string ext = file.substr(dot + 1);
+      std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+      return ext;
+    }
+
+    // Level 1 deflates several times faster than the higher levels on
+    // sorted images, whose long gradients compress well at any level
+    constexpr int fastPngLevel = 1;
+  }
+
+  std::vector<int> encodeParams(const EncodeOptions& options, const std::string& file)
+  {
+    std::vector<int> params;
+    std::string ext = extension(file);
+    if (ext == "png")
+    {
+      int level = options.pngLevel >= 0 ? options.pngLevel : options.fast ? fastPngLevel : -1;
+      if (level >= 0) params.insert(params.end(), {cv::IMWRITE_PNG_COMPRESSION, level});
+    }
+    else if (ext == "jpg" || ext == "jpeg" || ext == "jpe")
+    {
+      if (options.jpegQuality >= 0) params.insert(params.end(), {cv::IMWRITE_JPEG_QUALITY, options.jpegQuality});
+    }
+    else if (ext == "webp")
+    {
+      if (options.webpQuality >= 0) params.insert(params.end(), {cv::IMWRITE_WEBP_QUALITY, options.webpQuality});
+    }
+    return params;
+  }
+
+  void writeImage(const std::string& file, const cv::Mat& img, const std::vector<int>& params)
+  {
+    if (!cv::imwrite(file, img, params))
+    {
+      throw std::runtime_error("Failed to write image to " + file + "\n");
+    }
+  }
+}
@@ -1,4 +1,5 @@
 #include "cliConfig.hpp"
+#include "perfCounters.hpp"
 
 int main(int argc, char** argv )
 {
@@ -8,8 +9,27 @@ int main(int argc, char** argv )
   cliSetup(app, configData);
   CLI11_PARSE(app, argc, argv);
   
+  if (configData.rawWidth > 0)
+  {
+    processRawFrames(configData);
+    printProfile(configData);
+    return 0;
+  }
+
   // Image processing
   cv::Mat img = loadImage(configData);
-  applyImageProcessing(img, configData);
-  displayImage(img);
+  std::future<void> written = applyImageProcessing(img, configData);
+  if (!configData.noDisplay) displayImage(img);
+  // the output is encoded while the result is on screen
+  if (written.valid())
+  {
+    // the encoder thread's counts are added to ours when it exits. get()
+    // can return before that, but dropping the future joins the thread, so
+    // they land inside the stage. The time is only what was left after the
+    // window closed.
+    pixSort::PerfStage stage("encode", img.total());
+    written.get();
+    written = std::future<void>();
+  }
+  printProfile(configData);
 }
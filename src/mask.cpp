@@ -0,0 +1,109 @@
+#include "mask.hpp"
+
+namespace pixSort
+{
+  namespace
+  {
+    // Appends the runs of masked positions in [0, length) that are long
+    // enough to need sorting.
+    template <typename Lookup>
+    void appendRuns(SpanTable& table, int length, Lookup masked)
+    {
+      int j = 0;
+      while (j < length)
+      {
+        while (j < length && !masked(j)) ++j;
+        int start = j;
+        while (j < length && masked(j)) ++j;
+        if (j - start > 1) table.spans.push_back(cv::Range(start, j));
+      }
+      table.offsets.push_back(static_cast<int>(table.spans.size()));
+    }
+
+    // Mask bands are given on the 8-bit scale whatever the image depth
+    cv::Mat to8Bit(const cv::Mat& img)
+    {
+      if (img.depth() == CV_8U) return img;
+      cv::Mat converted;
+      img.convertTo(converted, CV_8U, img.depth() == CV_16U ? 1.0 / 257.0 : 255.0);
+      return converted;
+    }
+  }
+
+  cv::Mat loadMask(const std::string& file, cv::Size size)
+  {
+    cv::Mat mask = cv::imread(file, cv::IMREAD_GRAYSCALE);
+    if (mask.empty()) {
+        throw std::runtime_error("Failed to load mask from " + file);
+    }
+    if (mask.size() != size)
+    {
+      cv::resize(mask, mask, size, 0, 0, cv::INTER_NEAREST);
+    }
+    cv::threshold(mask, mask, 0, 255, cv::THRESH_BINARY);
+    return mask;
+  }
+
+  cv::Mat brightnessMask(const cv::Mat& img, int low, int high)
+  {
+    cv::Mat gray, mask;
+    cv::cvtColor(to8Bit(img), gray, cv::COLOR_BGR2GRAY);
+    cv::inRange(gray, cv::Scalar(low), cv::Scalar(high), mask);
+    return mask;
+  }
+
+  cv::Mat edgeMask(const cv::Mat& img, int low, int high)
+  {
+    cv::Mat gray, mask;
+    cv::cvtColor(to8Bit(img), gray, cv::COLOR_BGR2GRAY);
+    cv::Canny(gray, mask, low, high);
+    return mask;
+  }
+
+  cv::Mat saturationMask(const cv::Mat& img, int low, int high)
+  {
+    cv::Mat hsv, saturation, mask;
+    cv::cvtColor(to8Bit(img), hsv, cv::COLOR_BGR2HSV);
+    cv::extractChannel(hsv, saturation, 1);
+    cv::inRange(saturation, cv::Scalar(low), cv::Scalar(high), mask);
+    return mask;
+  }
+
+  SpanTable rowSpans(const cv::Mat& mask, int rows, int cols)
+  {
+    SpanTable table;
+    if (mask.empty())
+    {
+      table.spans.assign(rows, cv::Range(0, cols));
+      for (int i = 1; i <= rows; ++i) table.offsets.push_back(i);
+      return table;
+    }
+
+    for (int i = 0; i < rows; ++i)
+    {
+      const uchar* m = mask.ptr<uchar>(i);
+      appendRuns(table, cols, [m](int j) { return m[j] != 0; });
+    }
+    return table;
+  }
+
+  SpanTable lineSpans(const cv::Mat& mask, const LineTable& lines)
+  {
+    CV_Assert(mask.empty() || mask.isContinuous());
+    SpanTable table;
+    for (size_t k = 0; k < lines.lineCount(); ++k)
+    {
+      const int* index = lines.index.data() + lines.offsets[k];
+      int length = lines.offsets[k + 1] - lines.offsets[k];
+      if (mask.empty())
+      {
+        table.spans.push_back(cv::Range(0, length));
+        table.offsets.push_back(static_cast<int>(table.spans.size()));
+        continue;
+      }
+      const uchar* m = mask.ptr<uchar>(0);
+      appendRuns(table, length, [m, index](int n) { return m[index[n]] != 0; });
+    }
+    return table;
+  }
+}
@@ -0,0 +1,268 @@
+#include "numa.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace pixSort
+{
+  namespace
+  {
+    // Parses sysfs cpu lists like "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string& text)
+    {
+      std::vector<int> cpus;
+      std::istringstream in(text);
+      std::string range;
+      while (std::getline(in, range, ','))
+      {
+        int first = 0, last = 0;
+        char dash = 0;
+        std::istringstream part(range);
+        if (!(part >> first)) continue;
+        if (part >> dash >> last && dash == '-')
+        {
+          for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        else
+        {
+          cpus.push_back(first);
+        }
+      }
+      return cpus;
+    }
+
+    std::vector<std::vector<int>> detectNodes()
+    {
+      std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+      // node numbers can have gaps, so look a little past the last one found
+      for (int node = 0, missing = 0; missing < 8; ++node)
+      {
+        std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string text;
+        if (!std::getline(list, text))
+        {
+          ++missing;
+          continue;
+        }
+        missing = 0;
+        std::vector<int> cpus = parseCpuList(text);
+        if (!cpus.empty()) nodes.push_back(cpus);
+      }
+#endif
+      if (nodes.empty())
+      {
+        nodes.emplace_back();
+        for (int cpu = 0, n = std::max(1u, std::thread::hardware_concurrency()); cpu < n; ++cpu)
+        {
+          nodes.back().push_back(cpu);
+        }
+      }
+      return nodes;
+    }
+
+    void pinThread(int cpu)
+    {
+#if defined(__linux__)
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      // best effort: a cgroup may not allow this CPU
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+      (void)cpu;
+#endif
+    }
+
+    // One CPU per worker, taken from the nodes in turn and grouped by node
+    std::vector<int> workerCpus()
+    {
+      const std::vector<std::vector<int>>& nodes = numaNodes();
+      size_t total = 0;
+      for (const std::vector<int>& cpus : nodes) total += cpus.size();
+      size_t workers = std::min<size_t>(total, size_t(std::max(1, cv::getNumThreads())));
+
+      std::vector<size_t> taken(nodes.size(), 0);
+      for (size_t w = 0, node = 0; w < workers; node = (node + 1) % nodes.size())
+      {
+        if (taken[node] < nodes[node].size())
+        {
+          ++taken[node];
+          ++w;
+        }
+      }
+      std::vector<int> cpus;
+      for (size_t node = 0; node < nodes.size(); ++node)
+      {
+        cpus.insert(cpus.end(), nodes[node].begin(), nodes[node].begin() + taken[node]);
+      }
+      return cpus;
+    }
+
+    // Pinned workers kept between numaParallelFor calls, worker w running
+    // block w of every call. Restarted when the worker CPUs change.
+    class PinnedPool
+    {
+    public:
+      ~PinnedPool()
+      {
+        stop();
+      }
+
+      void run(const std::vector<int>& cpus, int n, int blocks, const std::function<void(const cv::Range&)>& body)
+      {
+        std::lock_guard<std::mutex> call(callMutex);
+        if (cpus != pinned)
+        {
+          stop();
+          start(cpus);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &body;
+        jobSize = n;
+        jobBlocks = blocks;
+        errors.assign(blocks, nullptr);
+        pending = blocks;
+        ++generation;
+        wake.notify_all();
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+        for (const std::exception_ptr& error : errors)
+        {
+          if (error) std::rethrow_exception(error);
+        }
+      }
+
+      // set on the workers, whose nested calls run inline
+      static thread_local bool inWorker;
+
+    private:
+      void start(const std::vector<int>& cpus)
+      {
+        stopping = false;
+        pinned = cpus;
+        for (int w = 0; w < static_cast<int>(cpus.size()); ++w)
+        {
+          // workers wait for calls after this one, even if they start late
+          threads.emplace_back([this, w, cpu = cpus[w], seen = generation] { work(w, cpu, seen); });
+        }
+      }
+
+      void stop()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) thread.join();
+        threads.clear();
+        pinned.clear();
+      }
+
+      void work(int w, int cpu, uint64_t seen)
+      {
+        pinThread(cpu);
+        inWorker = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+          wake.wait(lock, [&] { return stopping || generation != seen; });
+          if (stopping) return;
+          seen = generation;
+          if (w >= jobBlocks) continue;
+
+          cv::Range block(int(int64_t(jobSize) * w / jobBlocks), int(int64_t(jobSize) * (w + 1) / jobBlocks));
+          const std::function<void(const cv::Range&)>& body = *job;
+          lock.unlock();
+          std::exception_ptr error;
+          try { body(block); }
+          catch (...) { error = std::current_exception(); }
+          lock.lock();
+          errors[w] = error;
+          if (--pending == 0) done.notify_one();
+        }
+      }
+
+      std::mutex callMutex;
+      std::mutex mutex;
+      std::condition_variable wake;
+      std::condition_variable done;
+      std::vector<std::thread> threads;
+      std::vector<int> pinned;
+      bool stopping = false;
+      uint64_t generation = 0;
+      const std::function<void(const cv::Range&)>* job = nullptr;
+      int jobSize = 0;
+      int jobBlocks = 0;
+      int pending = 0;
+      std::vector<std::exception_ptr> errors;
+    };
+
+    thread_local bool PinnedPool::inWorker = false;
+
+    PinnedPool& pinnedPool()
+    {
+      static PinnedPool pool;
+      return pool;
+    }
+
+    std::atomic<bool> placement{false};
+  }
+
+  const std::vector<std::vector<int>>& numaNodes()
+  {
+    static const std::vector<std::vector<int>> nodes = detectNodes();
+    return nodes;
+  }
+
+  bool numaPlacement()
+  {
+    return placement.load(std::memory_order_relaxed);
+  }
+
+  void setNumaPlacement(bool enabled)
+  {
+    placement.store(enabled, std::memory_order_relaxed);
+  }
+
+  void numaParallelFor(int n, const std::function<void(const cv::Range&)>& body)
+  {
+    std::vector<int> cpus = workerCpus();
+    int workers = std::min(static_cast<int>(cpus.size()), n);
+    if (workers <= 1 || PinnedPool::inWorker)
+    {
+      if (n > 0) body(cv::Range(0, n));
+      return;
+    }
+    pinnedPool().run(cpus, n, workers, body);
+  }
+
+  cv::Mat numaPlace(const cv::Mat& img)
+  {
+    // allocation only reserves pages, the first write decides their node
+    cv::Mat placed(img.rows, img.cols, img.type());
+    size_t rowBytes = img.cols * img.elemSize();
+    numaParallelFor(img.rows, [&](const cv::Range& rows)
+    {
+      for (int y = rows.start; y < rows.end; ++y)
+      {
+        std::memcpy(placed.ptr(y), img.ptr(y), rowBytes);
+      }
+    });
+    return placed;
+  }
+}
@@ -0,0 +1,210 @@
+#include "perfCounters.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pixSort
+{
+  namespace
+  {
+    std::mutex mutex;
+    std::atomic<bool> started{false};
+    std::string unavailable = "counters were not started";
+    std::vector<int> fds[perfEventCount]; // one per thread and event
+    std::vector<StageCounts> stages;
+
+    double nowMs()
+    {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+#if defined(__linux__)
+    perf_event_attr eventAttr(PerfEvent event)
+    {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      switch (event)
+      {
+      case PerfEvent::Cycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case PerfEvent::Instructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case PerfEvent::L1dMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      case PerfEvent::LlcMisses:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case PerfEvent::BranchMisses:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      default:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+        break;
+      }
+      // user space only, which is all perf_event_paranoid 2 allows
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.inherit = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      return attr;
+    }
+
+    // Sum over the threads, scaled up for the time the PMU was shared
+    uint64_t readEvent(int event)
+    {
+      double total = 0;
+      for (int fd : fds[event])
+      {
+        uint64_t values[3];
+        if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) continue;
+        total += double(values[0]) * values[1] / values[2];
+      }
+      return static_cast<uint64_t>(total);
+    }
+#endif
+
+    bool anyCounted()
+    {
+      for (const std::vector<int>& event : fds)
+      {
+        if (!event.empty()) return true;
+      }
+      return false;
+    }
+
+    void readAll(uint64_t (&values)[perfEventCount])
+    {
+      for (int e = 0; e < perfEventCount; ++e)
+      {
+#if defined(__linux__)
+        values[e] = fds[e].empty() ? 0 : readEvent(e);
+#else
+        values[e] = 0;
+#endif
+      }
+    }
+  }
+
+  const char* perfEventName(PerfEvent event)
+  {
+    switch (event)
+    {
+    case PerfEvent::Cycles: return "cycles";
+    case PerfEvent::Instructions: return "instructions";
+    case PerfEvent::L1dMisses: return "L1d misses";
+    case PerfEvent::LlcMisses: return "LLC misses";
+    case PerfEvent::BranchMisses: return "branch misses";
+    case PerfEvent::PageFaults: return "page faults";
+    default: return "?";
+    }
+  }
+
+  bool startPerfCounters()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (started.load()) return anyCounted();
+
+    // start the worker pool now, its threads would not be counted otherwise
+    cv::parallel_for_(cv::Range(0, std::max(1, cv::getNumThreads())), [](const cv::Range&) {});
+
+#if defined(__linux__)
+    std::vector<pid_t> threads;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("/proc/self/task", error))
+    {
+      threads.push_back(static_cast<pid_t>(std::stol(entry.path().filename().string())));
+    }
+
+    unavailable.clear();
+    for (int e = 0; e < perfEventCount; ++e)
+    {
+      perf_event_attr attr = eventAttr(static_cast<PerfEvent>(e));
+      for (pid_t thread : threads)
+      {
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, thread, -1, -1, 0));
+        if (fd < 0)
+        {
+          // an event the CPU lacks fails on every thread, so drop it whole
+          if (unavailable.empty())
+          {
+            unavailable = std::string(perfEventName(static_cast<PerfEvent>(e))) + ": " + std::strerror(errno);
+          }
+          for (int open : fds[e]) close(open);
+          fds[e].clear();
+          break;
+        }
+        fds[e].push_back(fd);
+      }
+    }
+#else
+    unavailable = "counters are only read on Linux";
+#endif
+    started.store(true);
+    return anyCounted();
+  }
+
+  std::string perfUnavailableReason()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return unavailable;
+  }
+
+  PerfStage::PerfStage(std::string name, uint64_t pixels)
+    : active(started.load()), start(0)
+  {
+    if (!active) return;
+    counts.name = std::move(name);
+    counts.pixels = pixels;
+    std::lock_guard<std::mutex> lock(mutex);
+    readAll(counts.values);
+    for (int e = 0; e < perfEventCount; ++e) counts.counted[e] = !fds[e].empty();
+    start = nowMs();
+  }
+
+  PerfStage::~PerfStage()
+  {
+    if (!active) return;
+    double end = nowMs();
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t values[perfEventCount];
+    readAll(values);
+    for (int e = 0; e < perfEventCount; ++e) counts.values[e] = values[e] - counts.values[e];
+    counts.ms = end - start;
+    counts.runs = 1;
+
+    auto same = std::find_if(stages.begin(), stages.end(), [&](const StageCounts& s) { return s.name == counts.name; });
+    if (same == stages.end())
+    {
+      stages.push_back(counts);
+      return;
+    }
+    same->runs += counts.runs;
+    same->pixels += counts.pixels;
+    same->ms += counts.ms;
+    for (int e = 0; e < perfEventCount; ++e) same->values[e] += counts.values[e];
+  }
+
+  std::vector<StageCounts> perfStages()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stages;
+  }
+}
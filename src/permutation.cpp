@@ -0,0 +1,198 @@
+#include "permutation.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace pixSort
+{
+  namespace
+  {
+    const char magic[4] = {'P', 'X', 'S', 'P'};
+    constexpr uint8_t version = 1;
+
+    void putVarint(std::vector<uint8_t>& out, uint64_t v)
+    {
+      while (v >= 0x80)
+      {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+      }
+      out.push_back(static_cast<uint8_t>(v));
+    }
+
+    uint64_t getVarint(const uint8_t*& in, const uint8_t* end)
+    {
+      uint64_t v = 0;
+      for (int shift = 0; shift < 64; shift += 7)
+      {
+        if (in == end) break;
+        uint8_t byte = *in++;
+        v |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return v;
+      }
+      throw std::runtime_error("Corrupt permutation file.\n");
+    }
+
+    uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+    int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+    // Token 0 starts a run of unmoved pixels and is followed by its length
+    void encodeRow(std::vector<uint8_t>& out, const int* origins, int64_t first, int cols)
+    {
+      int x = 0;
+      while (x < cols)
+      {
+        int64_t delta = origins[x] - (first + x);
+        if (delta != 0)
+        {
+          putVarint(out, zigzag(delta));
+          ++x;
+          continue;
+        }
+        int run = 1;
+        while (x + run < cols && origins[x + run] == first + x + run) ++run;
+        putVarint(out, 0);
+        putVarint(out, run - 1);
+        x += run;
+      }
+    }
+
+    void decodeRow(const uint8_t* in, const uint8_t* end, int* origins, int64_t first, int cols, int64_t total)
+    {
+      int x = 0;
+      while (x < cols)
+      {
+        uint64_t token = getVarint(in, end);
+        if (token == 0)
+        {
+          uint64_t run = getVarint(in, end) + 1;
+          if (run > uint64_t(cols - x)) throw std::runtime_error("Corrupt permutation file.\n");
+          for (uint64_t r = 0; r < run; ++r, ++x) origins[x] = static_cast<int>(first + x);
+          continue;
+        }
+        int64_t origin = first + x + unzigzag(token);
+        if (origin < 0 || origin >= total) throw std::runtime_error("Corrupt permutation file.\n");
+        origins[x++] = static_cast<int>(origin);
+      }
+      if (in != end) throw std::runtime_error("Corrupt permutation file.\n");
+    }
+  }
+
+  cv::Mat identityOrigins(int rows, int cols)
+  {
+    cv::Mat origins(rows, cols, CV_32SC1);
+    for (int y = 0; y < rows; ++y)
+    {
+      int* row = origins.ptr<int>(y);
+      for (int x = 0; x < cols; ++x) row[x] = y * cols + x;
+    }
+    return origins;
+  }
+
+  void savePermutation(const std::string& file, const cv::Mat& origins)
+  {
+    // rows are encoded independently, so they compress in parallel
+    std::vector<std::vector<uint8_t>> rows(origins.rows);
+    cv::parallel_for_(cv::Range(0, origins.rows), [&](const cv::Range& range)
+    {
+      for (int y = range.start; y < range.end; ++y)
+      {
+        encodeRow(rows[y], origins.ptr<int>(y), int64_t(y) * origins.cols, origins.cols);
+      }
+    });
+
+    std::vector<uint8_t> header(magic, magic + 4);
+    header.push_back(version);
+    putVarint(header, origins.rows);
+    putVarint(header, origins.cols);
+
+    std::ofstream out(file, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    for (const std::vector<uint8_t>& row : rows)
+    {
+      std::vector<uint8_t> length;
+      putVarint(length, row.size());
+      out.write(reinterpret_cast<const char*>(length.data()), length.size());
+      out.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    if (!out)
+    {
+      throw std::runtime_error("Failed to write permutation to " + file + "\n");
+    }
+  }
+
+  cv::Mat loadPermutation(const std::string& file)
+  {
+    std::ifstream in(file, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.eof() && !in)
+    {
+      throw std::runtime_error("Failed to read permutation from " + file + "\n");
+    }
+    if (bytes.size() < 5 || std::memcmp(bytes.data(), magic, 4) != 0 || bytes[4] != version)
+    {
+      throw std::runtime_error(file + " is not a pixSort permutation file.\n");
+    }
+
+    const uint8_t* cursor = bytes.data() + 5;
+    const uint8_t* end = bytes.data() + bytes.size();
+    uint64_t rows = getVarint(cursor, end);
+    uint64_t cols = getVarint(cursor, end);
+    if (rows == 0 || cols == 0 || rows * cols > uint64_t(INT32_MAX))
+    {
+      throw std::runtime_error("Corrupt permutation file.\n");
+    }
+
+    // find every row block first so they can be decoded in parallel
+    std::vector<const uint8_t*> starts(rows);
+    std::vector<const uint8_t*> ends(rows);
+    for (uint64_t y = 0; y < rows; ++y)
+    {
+      uint64_t length = getVarint(cursor, end);
+      if (length > uint64_t(end - cursor)) throw std::runtime_error("Corrupt permutation file.\n");
+      starts[y] = cursor;
+      cursor += length;
+      ends[y] = cursor;
+    }
+    if (cursor != end) throw std::runtime_error("Corrupt permutation file.\n");
+
+    cv::Mat origins(static_cast<int>(rows), static_cast<int>(cols), CV_32SC1);
+    int64_t total = int64_t(rows * cols);
+    cv::parallel_for_(cv::Range(0, origins.rows), [&](const cv::Range& range)
+    {
+      for (int y = range.start; y < range.end; ++y)
+      {
+        decodeRow(starts[y], ends[y], origins.ptr<int>(y), int64_t(y) * origins.cols, origins.cols, total);
+      }
+    });
+    return origins;
+  }
+
+  cv::Mat applyPermutation(const cv::Mat& src, const cv::Mat& origins)
+  {
+    if (src.size() != origins.size())
+    {
+      throw std::runtime_error("The permutation was recorded on an image of a different size.\n");
+    }
+
+    cv::Mat dst(src.rows, src.cols, src.type());
+    size_t pixelSize = src.elemSize();
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+      for (int y = range.start; y < range.end; ++y)
+      {
+        const int* origin = origins.ptr<int>(y);
+        uchar* out = dst.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; ++x)
+        {
+          const uchar* in = src.ptr<uchar>(origin[x] / src.cols) + size_t(origin[x] % src.cols) * pixelSize;
+          std::memcpy(out + size_t(x) * pixelSize, in, pixelSize);
+        }
+      }
+    });
+    return dst;
+  }
+}
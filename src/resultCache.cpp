@@ -0,0 +1,263 @@
+#include "resultCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace pixSort
+{
+  namespace
+  {
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+    uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    uint64_t read64(const uint8_t* p)
+    {
+      uint64_t v;
+      std::memcpy(&v, p, 8);
+      return v;
+    }
+
+    uint32_t read32(const uint8_t* p)
+    {
+      uint32_t v;
+      std::memcpy(&v, p, 4);
+      return v;
+    }
+
+    uint64_t round(uint64_t acc, uint64_t input)
+    {
+      acc += input * prime2;
+      return rotl(acc, 31) * prime1;
+    }
+
+    uint64_t merge(uint64_t acc, uint64_t v)
+    {
+      acc ^= round(0, v);
+      return acc * prime1 + prime4;
+    }
+
+    const char* statsName = "stats";
+    const char* tmpSuffix = ".tmp";
+    // entries and the outputs linked to them
+    constexpr fs::perms readOnly = fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read;
+  }
+
+  uint64_t xxHash64(const void* data, size_t size, uint64_t seed)
+  {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+      uint64_t v1 = seed + prime1 + prime2;
+      uint64_t v2 = seed + prime2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - prime1;
+      for (; p + 32 <= end; p += 32)
+      {
+        v1 = round(v1, read64(p));
+        v2 = round(v2, read64(p + 8));
+        v3 = round(v3, read64(p + 16));
+        v4 = round(v4, read64(p + 24));
+      }
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge(h, v1);
+      h = merge(h, v2);
+      h = merge(h, v3);
+      h = merge(h, v4);
+    }
+    else
+    {
+      h = seed + prime5;
+    }
+
+    h += size;
+    for (; p + 8 <= end; p += 8)
+    {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end)
+    {
+      h ^= uint64_t(read32(p)) * prime1;
+      h = rotl(h, 23) * prime2 + prime3;
+      p += 4;
+    }
+    for (; p < end; ++p)
+    {
+      h ^= *p * prime5;
+      h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  uint64_t hashImage(const cv::Mat& img)
+  {
+    int64_t shape[3] = {img.rows, img.cols, img.type()};
+    uint64_t h = xxHash64(shape, sizeof(shape));
+    size_t rowBytes = img.cols * img.elemSize();
+    if (img.isContinuous())
+    {
+      return xxHash64(img.data, rowBytes * img.rows, h);
+    }
+    // padded rows are packed first so the hash only sees pixels
+    cv::Mat packed = img.clone();
+    return xxHash64(packed.data, rowBytes * img.rows, h);
+  }
+
+  uint64_t hashFile(const std::string& file)
+  {
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+      throw std::runtime_error("Failed to read " + file + "\n");
+    }
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return xxHash64(bytes.data(), bytes.size());
+  }
+
+  ResultCache::ResultCache(const std::string& dir, uint64_t maxBytes)
+    : dir(dir), maxBytes(maxBytes)
+  {
+    std::error_code error;
+    fs::create_directories(dir, error);
+    if (error)
+    {
+      throw std::runtime_error("Failed to create cache directory " + dir + ": " + error.message() + "\n");
+    }
+    std::ifstream in(fs::path(dir) / statsName);
+    in >> counts.hits >> counts.misses >> counts.evictions;
+  }
+
+  std::string ResultCache::entryPath(uint64_t key, const std::string& output) const
+  {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return (fs::path(dir) / (name + fs::path(output).extension().string())).string();
+  }
+
+  bool ResultCache::fetch(uint64_t key, const std::string& output)
+  {
+    std::string entry = entryPath(key, output);
+    std::error_code error;
+    if (!fs::is_regular_file(entry, error))
+    {
+      ++counts.misses;
+      saveCounts();
+      return false;
+    }
+
+    // the output shares the entry's inode, and the entry is read-only, so
+    // writing the output in place fails instead of changing the entry;
+    // replacing it (as pixSort does) is fine. Root ignores the mode, so it
+    // must not rewrite the output in place.
+    fs::permissions(entry, readOnly, error);
+    fs::remove(output, error);
+    fs::create_hard_link(entry, output, error);
+    if (error && !fs::copy_file(entry, output, fs::copy_options::overwrite_existing, error))
+    {
+      throw std::runtime_error("Failed to copy cached result to " + output + ": " + error.message() + "\n");
+    }
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), error);
+    ++counts.hits;
+    saveCounts();
+    return true;
+  }
+
+  void ResultCache::store(uint64_t key, const std::string& output)
+  {
+    // copied under a temporary name and renamed, so concurrent runs never
+    // see half an entry
+    std::string entry = entryPath(key, output);
+    std::string tmp = entry + tmpSuffix;
+    std::error_code error;
+    fs::remove(tmp, error);
+    if (!fs::copy_file(output, tmp, error))
+    {
+      throw std::runtime_error("Failed to add " + output + " to the cache: " + error.message() + "\n");
+    }
+    fs::permissions(tmp, readOnly, error);
+    fs::rename(tmp, entry, error);
+    if (error)
+    {
+      fs::remove(tmp, error);
+      return;
+    }
+
+    struct Entry
+    {
+      fs::path path;
+      fs::file_time_type used;
+      uint64_t bytes;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(dir, error))
+    {
+      if (!file.is_regular_file(error) || file.path().filename() == statsName
+          || file.path().extension() == tmpSuffix)
+      {
+        continue;
+      }
+      Entry e{file.path(), file.last_write_time(error), file.file_size(error)};
+      total += e.bytes;
+      entries.push_back(e);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& e : entries)
+    {
+      if (total <= maxBytes) break;
+      if (fs::remove(e.path, error))
+      {
+        total -= e.bytes;
+        ++counts.evictions;
+      }
+    }
+    saveCounts();
+  }
+
+  CacheStats ResultCache::stats() const
+  {
+    CacheStats stats = counts;
+    std::error_code error;
+    for (const fs::directory_entry& file : fs::directory_iterator(dir, error))
+    {
+      if (!file.is_regular_file(error) || file.path().filename() == statsName
+          || file.path().extension() == tmpSuffix)
+      {
+        continue;
+      }
+      ++stats.entries;
+      stats.bytes += file.file_size(error);
+    }
+    return stats;
+  }
+
+  void ResultCache::saveCounts() const
+  {
+    std::ofstream out(fs::path(dir) / statsName);
+    out << counts.hits << ' ' << counts.misses << ' ' << counts.evictions << '\n';
+  }
+}
@@ -0,0 +1,137 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace pixSort
+{
+  namespace
+  {
+    using Clock = std::chrono::steady_clock;
+
+    // Chunks per worker: enough to even out uneven rows, few enough that
+    // taking one stays cheap next to sorting it
+    constexpr int chunksPerWorker = 16;
+
+    // A worker's remaining chunks [head, tail), packed in one word so the
+    // owner (front) and thieves (back) can both take with a single CAS
+    struct alignas(64) Deque
+    {
+      std::atomic<uint64_t> range{0};
+    };
+
+    uint64_t pack(uint32_t head, uint32_t tail) { return (uint64_t(head) << 32) | tail; }
+    uint32_t head(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+    uint32_t tail(uint64_t range) { return static_cast<uint32_t>(range); }
+
+    bool popFront(Deque& deque, uint32_t& chunk)
+    {
+      uint64_t range = deque.range.load(std::memory_order_acquire);
+      while (head(range) < tail(range))
+      {
+        if (deque.range.compare_exchange_weak(range, pack(head(range) + 1, tail(range)), std::memory_order_acq_rel))
+        {
+          chunk = head(range);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool stealBack(Deque& deque, uint32_t& first, uint32_t& last)
+    {
+      uint64_t range = deque.range.load(std::memory_order_acquire);
+      while (head(range) < tail(range))
+      {
+        uint32_t take = (tail(range) - head(range) + 1) / 2;
+        if (deque.range.compare_exchange_weak(range, pack(head(range), tail(range) - take), std::memory_order_acq_rel))
+        {
+          first = tail(range) - take;
+          last = tail(range);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    std::mutex statsMutex;
+    std::vector<WorkerStats> totals;
+  }
+
+  void stealingParallelFor(int n, const std::function<void(const cv::Range&)>& body)
+  {
+    if (n <= 0) return;
+    int workers = std::max(1, cv::getNumThreads());
+    int chunkSize = std::max(1, n / (workers * chunksPerWorker));
+    uint32_t chunks = static_cast<uint32_t>((n + chunkSize - 1) / chunkSize);
+    workers = std::min<int>(workers, chunks);
+
+    std::unique_ptr<Deque[]> deques(new Deque[workers]);
+    for (int w = 0; w < workers; ++w)
+    {
+      deques[w].range.store(pack(uint32_t(uint64_t(chunks) * w / workers), uint32_t(uint64_t(chunks) * (w + 1) / workers)));
+    }
+    std::vector<WorkerStats> stats(workers);
+
+    auto runChunk = [&](uint32_t chunk, WorkerStats& worker)
+    {
+      auto start = Clock::now();
+      body(cv::Range(int(chunk) * chunkSize, std::min(n, int(chunk + 1) * chunkSize)));
+      worker.busyMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      ++worker.chunks;
+    };
+
+    // Correct however many workers actually run at once: a worker that
+    // finds every deque empty is done, and stolen chunks are run by the thief
+    auto start = Clock::now();
+    cv::parallel_for_(cv::Range(0, workers), [&](const cv::Range& range)
+    {
+      for (int w = range.start; w < range.end; ++w)
+      {
+        WorkerStats& worker = stats[w];
+        uint32_t chunk, first, last;
+        for (;;)
+        {
+          while (popFront(deques[w], chunk)) runChunk(chunk, worker);
+
+          bool stole = false;
+          for (int v = 1; v < workers && !stole; ++v)
+          {
+            stole = stealBack(deques[(w + v) % workers], first, last);
+          }
+          if (!stole) break;
+
+          ++worker.steals;
+          deques[w].range.store(pack(first + 1, last), std::memory_order_release);
+          runChunk(first, worker);
+        }
+      }
+    }, workers);
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (totals.size() < stats.size()) totals.resize(stats.size());
+    for (int w = 0; w < workers; ++w)
+    {
+      totals[w].chunks += stats[w].chunks;
+      totals[w].steals += stats[w].steals;
+      totals[w].busyMs += stats[w].busyMs;
+      totals[w].idleMs += std::max(0.0, wallMs - stats[w].busyMs);
+    }
+  }
+
+  std::vector<WorkerStats> schedulerStats()
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return totals;
+  }
+
+  void resetSchedulerStats()
+  {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    totals.clear();
+  }
+}
@@ -0,0 +1,194 @@
+#include "sortKeys.hpp"
+#include "cpuFeatures.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace pixSort
+{
+  KeySpec parseKey(const std::string& text)
+  {
+    KeySpec spec;
+    std::string name = text.substr(0, text.find(':'));
+    std::string args = name.size() < text.size() ? text.substr(name.size() + 1) : "";
+
+    if (name == "brightness") { spec.kind = KeySpec::Kind::Brightness; }
+    else if (name == "hue") { spec.kind = KeySpec::Kind::Hue; }
+    else if (name == "sat") { spec.kind = KeySpec::Kind::Saturation; }
+    else if (name == "value") { spec.kind = KeySpec::Kind::Value; }
+    else if (name == "luma") { spec.kind = KeySpec::Kind::Luma; }
+    else if (name == "max") { spec.kind = KeySpec::Kind::Max; }
+    else if (name == "min") { spec.kind = KeySpec::Kind::Min; }
+    else if (name == "channel")
+    {
+      spec.kind = KeySpec::Kind::Channel;
+      std::istringstream in(args);
+      if (!(in >> spec.channel) || !in.eof() || spec.channel < 0 || spec.channel > 2)
+      {
+        throw std::invalid_argument("channel key expects channel:0, channel:1 or channel:2");
+      }
+      return spec;
+    }
+    else if (name == "weighted")
+    {
+      spec.kind = KeySpec::Kind::Weighted;
+      std::istringstream in(args);
+      char comma0 = 0, comma1 = 0;
+      if (!(in >> spec.weights[0] >> comma0 >> spec.weights[1] >> comma1 >> spec.weights[2])
+          || comma0 != ',' || comma1 != ',' || !in.eof())
+      {
+        throw std::invalid_argument("weighted key expects weighted:w0,w1,w2");
+      }
+      return spec;
+    }
+    else
+    {
+      throw std::invalid_argument("unknown sort key '" + text + "'");
+    }
+
+    if (!args.empty())
+    {
+      throw std::invalid_argument("sort key '" + name + "' takes no arguments");
+    }
+    return spec;
+  }
+
+  template <typename Pixel>
+  KeyPacker<Pixel>::KeyPacker(const SortKey& key, float threshold)
+    : key(key), totalBits(0)
+  {
+    double scaled = threshold * ChannelTraits<Channel>::scale;
+    this->threshold = std::is_floating_point<Value>::value ? static_cast<Value>(scaled) : static_cast<Value>(std::ceil(scaled));
+
+    if (key.terms.empty())
+    {
+      throw std::invalid_argument("at least one sort key is required");
+    }
+    for (const KeySpec& term : key.terms)
+    {
+      withKey<Channel>(term, [this](auto k) { termBits.push_back(k.bits()); });
+      totalBits += termBits.back();
+    }
+    if (totalBits > 64)
+    {
+      throw std::invalid_argument("sort keys do not fit in 64 bits, use fewer or narrower keys");
+    }
+
+    // first terms of pixels that are not dim are at least the threshold, so
+    // shifting them down by it leaves room for dim pixels at the top
+    uint64_t top = (uint64_t(1) << termBits[0]) - 1;
+    if constexpr (std::is_floating_point<Value>::value)
+    {
+      offset = sortableBits(this->threshold);
+    }
+    else
+    {
+      // a threshold above every value makes all pixels dim, offset top keeps dimFirst at 1
+      offset = static_cast<uint64_t>(std::clamp<int64_t>(this->threshold, 0, int64_t(top)));
+    }
+    dimFirst = top + 1 - offset;
+  }
+
+  namespace
+  {
+    // The packing loops, compiled per CPU level (see dispatch). The key is
+    // resolved before dispatching so its functor inlines into each loop.
+
+    template <typename Word, typename Key>
+    struct FirstTermKernel
+    {
+      template <typename Pixel, typename Value>
+      PIXSORT_INLINE static void run(Key k, const Pixel* pixels, size_t n, Word* keys, Value threshold, Word offset,
+                                     Word dimFirst)
+      {
+        for (size_t i = 0; i < n; ++i)
+        {
+          Value v = k(pixels[i]);
+          Word dim = Word(0) - static_cast<Word>(v < threshold);
+          keys[i] = (dim & dimFirst) | (~dim & (static_cast<Word>(sortableBits(v)) - offset));
+        }
+      }
+    };
+
+    template <typename Word, typename Key>
+    struct TermKernel
+    {
+      template <typename Pixel>
+      PIXSORT_INLINE static void run(Key k, const Pixel* pixels, size_t n, Word* keys, int shift)
+      {
+        for (size_t i = 0; i < n; ++i)
+        {
+          keys[i] = (keys[i] << shift) | sortableBits(k(pixels[i]));
+        }
+      }
+    };
+
+    // Every key above last belongs to a dim pixel. Dim pixels all get one
+    // key, the largest (or with Reverse the smallest), and the order turns
+    // the others around below it.
+    template <typename Word>
+    struct FinishKernel
+    {
+      PIXSORT_INLINE static void run(Word* keys, size_t n, Word last, bool anyDim, SortOrder order)
+      {
+        Word dimKey = order == SortOrder::Reverse ? Word(0) : last + 1;
+        Word base = order == SortOrder::Ascending  ? Word(0)
+                  : order == SortOrder::Descending ? last
+                  :                                  last + anyDim;
+        Word sign = order == SortOrder::Ascending ? Word(0) : ~Word(0);
+        for (size_t i = 0; i < n; ++i)
+        {
+          Word dim = Word(0) - static_cast<Word>(keys[i] > last);
+          // base - key without a branch on the order: (key ^ sign) - sign negates
+          Word turned = base + ((keys[i] ^ sign) - sign);
+          keys[i] = (dim & dimKey) | (~dim & turned);
+        }
+      }
+    };
+  }
+
+  template <typename Pixel>
+  template <typename Word>
+  void KeyPacker<Pixel>::pack(const Pixel* pixels, size_t n, Word* keys) const
+  {
+    withKey<Channel>(key.terms[0], [&](auto k)
+    {
+      dispatch<FirstTermKernel<Word, decltype(k)>>(k, pixels, n, keys, threshold, Word(offset), Word(dimFirst));
+    });
+
+    for (size_t t = 1; t < key.terms.size(); ++t)
+    {
+      withKey<Channel>(key.terms[t], [&](auto k)
+      {
+        dispatch<TermKernel<Word, decltype(k)>>(k, pixels, n, keys, termBits[t]);
+      });
+    }
+
+    // largest key a pixel that is not dim can have
+    int lowBits = totalBits - termBits[0];
+    Word lowMask = lowBits == 0 ? Word(0) : ~Word(0) >> (int(sizeof(Word) * 8) - lowBits);
+    Word last = (Word(dimFirst - 1) << lowBits) | lowMask;
+    dispatch<FinishKernel<Word>>(keys, n, last, offset > 0, key.order);
+  }
+
+  template class KeyPacker<cv::Vec3b>;
+  template class KeyPacker<cv::Vec3w>;
+  template class KeyPacker<cv::Vec3f>;
+  template class KeyPacker<cv::Vec4b>;
+  template class KeyPacker<cv::Vec4w>;
+  template class KeyPacker<cv::Vec4f>;
+  template void KeyPacker<cv::Vec3b>::pack(const cv::Vec3b*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec3b>::pack(const cv::Vec3b*, size_t, uint64_t*) const;
+  template void KeyPacker<cv::Vec3w>::pack(const cv::Vec3w*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec3w>::pack(const cv::Vec3w*, size_t, uint64_t*) const;
+  template void KeyPacker<cv::Vec3f>::pack(const cv::Vec3f*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec3f>::pack(const cv::Vec3f*, size_t, uint64_t*) const;
+  template void KeyPacker<cv::Vec4b>::pack(const cv::Vec4b*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec4b>::pack(const cv::Vec4b*, size_t, uint64_t*) const;
+  template void KeyPacker<cv::Vec4w>::pack(const cv::Vec4w*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec4w>::pack(const cv::Vec4w*, size_t, uint64_t*) const;
+  template void KeyPacker<cv::Vec4f>::pack(const cv::Vec4f*, size_t, uint32_t*) const;
+  template void KeyPacker<cv::Vec4f>::pack(const cv::Vec4f*, size_t, uint64_t*) const;
+}
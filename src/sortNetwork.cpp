@@ -0,0 +1,296 @@
+#include "sortNetwork.hpp"
+#include "cpuFeatures.hpp"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(PIXSORT_X86_DISPATCH)
+#include <immintrin.h>
+#elif defined(PIXSORT_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace pixSort
+{
+  namespace
+  {
+    // Below this the padding to a full vector costs more than it saves
+    constexpr size_t networkMinSize = 8;
+
+    // Whole-word sorts, so every kernel produces exactly the same output
+    void scalarSort(uint32_t* words, size_t n)
+    {
+      std::sort(words, words + n);
+    }
+
+    void insertionSort(uint32_t* words, size_t n)
+    {
+      for (size_t i = 1; i < n; ++i)
+      {
+        uint32_t word = words[i];
+        size_t j = i;
+        for (; j > 0 && words[j - 1] > word; --j)
+        {
+          words[j] = words[j - 1];
+        }
+        words[j] = word;
+      }
+    }
+
+    // Copies words into a power-of-two buffer of at least `lanes` entries,
+    // padded with UINT32_MAX so the padding sorts to the end
+    size_t padded(uint32_t* buffer, const uint32_t* words, size_t n, size_t lanes)
+    {
+      size_t size = lanes;
+      while (size < n) size <<= 1;
+      std::copy(words, words + n, buffer);
+      std::fill(buffer + n, buffer + size, UINT32_MAX);
+      return size;
+    }
+
+#ifdef PIXSORT_X86_DISPATCH
+    // Every kernel runs the same bitonic network, instantiated per padded size
+    // so the compiler can unroll it. Exchanges between vectors (j >= lanes)
+    // are a min/max of two loads; exchanges inside a vector permute lane l
+    // with lane l ^ j and keep the max wherever bit j and bit k of the element
+    // index differ.
+
+    template <size_t size>
+    PIXSORT_TARGET_SSE42
+    void sse42Network(uint32_t* buffer)
+    {
+      const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+      const __m128i zero = _mm_setzero_si128();
+
+      for (size_t k = 2; k <= size; k <<= 1)
+      {
+        for (size_t j = k >> 1; j > 0; j >>= 1)
+        {
+          for (size_t i = 0; i < size; i += 4)
+          {
+            if (j >= 4)
+            {
+              if (i & j) continue;
+              __m128i a = _mm_load_si128(reinterpret_cast<__m128i*>(buffer + i));
+              __m128i b = _mm_load_si128(reinterpret_cast<__m128i*>(buffer + i + j));
+              __m128i lo = _mm_min_epu32(a, b);
+              __m128i hi = _mm_max_epu32(a, b);
+              bool ascending = (i & k) == 0;
+              _mm_store_si128(reinterpret_cast<__m128i*>(buffer + i), ascending ? lo : hi);
+              _mm_store_si128(reinterpret_cast<__m128i*>(buffer + i + j), ascending ? hi : lo);
+              continue;
+            }
+            __m128i v = _mm_load_si128(reinterpret_cast<__m128i*>(buffer + i));
+            __m128i p = j == 1 ? _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1))
+                               : _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+            __m128i index = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), lane);
+            __m128i jClear = _mm_cmpeq_epi32(_mm_and_si128(index, _mm_set1_epi32(static_cast<int>(j))), zero);
+            __m128i kClear = _mm_cmpeq_epi32(_mm_and_si128(index, _mm_set1_epi32(static_cast<int>(k))), zero);
+            __m128i takeMax = _mm_xor_si128(jClear, kClear);
+            __m128i result = _mm_blendv_epi8(_mm_min_epu32(v, p), _mm_max_epu32(v, p), takeMax);
+            _mm_store_si128(reinterpret_cast<__m128i*>(buffer + i), result);
+          }
+        }
+      }
+    }
+
+    PIXSORT_TARGET_SSE42
+    void sse42Sort(uint32_t* words, size_t n)
+    {
+      alignas(16) uint32_t buffer[networkMaxSize];
+      switch (padded(buffer, words, n, 4))
+      {
+      case 4: sse42Network<4>(buffer); break;
+      case 8: sse42Network<8>(buffer); break;
+      case 16: sse42Network<16>(buffer); break;
+      case 32: sse42Network<32>(buffer); break;
+      default: sse42Network<64>(buffer); break;
+      }
+      std::copy(buffer, buffer + n, words);
+    }
+
+    template <size_t size>
+    PIXSORT_TARGET_AVX2
+    void avx2Network(uint32_t* buffer)
+    {
+      const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+      const __m256i zero = _mm256_setzero_si256();
+
+      for (size_t k = 2; k <= size; k <<= 1)
+      {
+        for (size_t j = k >> 1; j > 0; j >>= 1)
+        {
+          for (size_t i = 0; i < size; i += 8)
+          {
+            if (j >= 8)
+            {
+              if (i & j) continue;
+              __m256i a = _mm256_load_si256(reinterpret_cast<__m256i*>(buffer + i));
+              __m256i b = _mm256_load_si256(reinterpret_cast<__m256i*>(buffer + i + j));
+              __m256i lo = _mm256_min_epu32(a, b);
+              __m256i hi = _mm256_max_epu32(a, b);
+              bool ascending = (i & k) == 0;
+              _mm256_store_si256(reinterpret_cast<__m256i*>(buffer + i), ascending ? lo : hi);
+              _mm256_store_si256(reinterpret_cast<__m256i*>(buffer + i + j), ascending ? hi : lo);
+              continue;
+            }
+            __m256i v = _mm256_load_si256(reinterpret_cast<__m256i*>(buffer + i));
+            __m256i p = _mm256_permutevar8x32_epi32(v, _mm256_xor_si256(lane, _mm256_set1_epi32(static_cast<int>(j))));
+            __m256i index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), lane);
+            __m256i jClear = _mm256_cmpeq_epi32(_mm256_and_si256(index, _mm256_set1_epi32(static_cast<int>(j))), zero);
+            __m256i kClear = _mm256_cmpeq_epi32(_mm256_and_si256(index, _mm256_set1_epi32(static_cast<int>(k))), zero);
+            __m256i takeMax = _mm256_xor_si256(jClear, kClear);
+            __m256i result = _mm256_blendv_epi8(_mm256_min_epu32(v, p), _mm256_max_epu32(v, p), takeMax);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(buffer + i), result);
+          }
+        }
+      }
+    }
+
+    PIXSORT_TARGET_AVX2
+    void avx2Sort(uint32_t* words, size_t n)
+    {
+      alignas(32) uint32_t buffer[networkMaxSize];
+      switch (padded(buffer, words, n, 8))
+      {
+      case 8: avx2Network<8>(buffer); break;
+      case 16: avx2Network<16>(buffer); break;
+      case 32: avx2Network<32>(buffer); break;
+      default: avx2Network<64>(buffer); break;
+      }
+      std::copy(buffer, buffer + n, words);
+    }
+
+    template <size_t size>
+    PIXSORT_TARGET_AVX512
+    void avx512Network(uint32_t* buffer)
+    {
+      const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+      for (size_t k = 2; k <= size; k <<= 1)
+      {
+        for (size_t j = k >> 1; j > 0; j >>= 1)
+        {
+          for (size_t i = 0; i < size; i += 16)
+          {
+            if (j >= 16)
+            {
+              if (i & j) continue;
+              __m512i a = _mm512_load_si512(buffer + i);
+              __m512i b = _mm512_load_si512(buffer + i + j);
+              __m512i lo = _mm512_min_epu32(a, b);
+              __m512i hi = _mm512_max_epu32(a, b);
+              bool ascending = (i & k) == 0;
+              _mm512_store_si512(buffer + i, ascending ? lo : hi);
+              _mm512_store_si512(buffer + i + j, ascending ? hi : lo);
+              continue;
+            }
+            __m512i v = _mm512_load_si512(buffer + i);
+            __m512i p = _mm512_permutexvar_epi32(_mm512_xor_si512(lane, _mm512_set1_epi32(static_cast<int>(j))), v);
+            __m512i index = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lane);
+            __mmask16 takeMax = _mm512_test_epi32_mask(index, _mm512_set1_epi32(static_cast<int>(j)))
+                              ^ _mm512_test_epi32_mask(index, _mm512_set1_epi32(static_cast<int>(k)));
+            __m512i result = _mm512_mask_blend_epi32(takeMax, _mm512_min_epu32(v, p), _mm512_max_epu32(v, p));
+            _mm512_store_si512(buffer + i, result);
+          }
+        }
+      }
+    }
+
+    PIXSORT_TARGET_AVX512
+    void avx512Sort(uint32_t* words, size_t n)
+    {
+      alignas(64) uint32_t buffer[networkMaxSize];
+      switch (padded(buffer, words, n, 16))
+      {
+      case 16: avx512Network<16>(buffer); break;
+      case 32: avx512Network<32>(buffer); break;
+      default: avx512Network<64>(buffer); break;
+      }
+      std::copy(buffer, buffer + n, words);
+    }
+#endif
+
+#ifdef PIXSORT_NEON
+    template <size_t size>
+    void neonNetwork(uint32_t* buffer)
+    {
+      static const uint32_t lanes[4] = {0, 1, 2, 3};
+      const uint32x4_t lane = vld1q_u32(lanes);
+
+      for (size_t k = 2; k <= size; k <<= 1)
+      {
+        for (size_t j = k >> 1; j > 0; j >>= 1)
+        {
+          for (size_t i = 0; i < size; i += 4)
+          {
+            if (j >= 4)
+            {
+              if (i & j) continue;
+              uint32x4_t a = vld1q_u32(buffer + i);
+              uint32x4_t b = vld1q_u32(buffer + i + j);
+              uint32x4_t lo = vminq_u32(a, b);
+              uint32x4_t hi = vmaxq_u32(a, b);
+              bool ascending = (i & k) == 0;
+              vst1q_u32(buffer + i, ascending ? lo : hi);
+              vst1q_u32(buffer + i + j, ascending ? hi : lo);
+              continue;
+            }
+            uint32x4_t v = vld1q_u32(buffer + i);
+            uint32x4_t p = j == 1 ? vrev64q_u32(v) : vextq_u32(v, v, 2);
+            uint32x4_t index = vaddq_u32(vdupq_n_u32(static_cast<uint32_t>(i)), lane);
+            uint32x4_t takeMax = veorq_u32(vtstq_u32(index, vdupq_n_u32(static_cast<uint32_t>(j))),
+                                           vtstq_u32(index, vdupq_n_u32(static_cast<uint32_t>(k))));
+            vst1q_u32(buffer + i, vbslq_u32(takeMax, vmaxq_u32(v, p), vminq_u32(v, p)));
+          }
+        }
+      }
+    }
+
+    void neonSort(uint32_t* words, size_t n)
+    {
+      alignas(16) uint32_t buffer[networkMaxSize];
+      switch (padded(buffer, words, n, 4))
+      {
+      case 4: neonNetwork<4>(buffer); break;
+      case 8: neonNetwork<8>(buffer); break;
+      case 16: neonNetwork<16>(buffer); break;
+      case 32: neonNetwork<32>(buffer); break;
+      default: neonNetwork<64>(buffer); break;
+      }
+      std::copy(buffer, buffer + n, words);
+    }
+#endif
+  }
+
+  void networkSort(uint32_t* words, size_t n)
+  {
+    if (n < networkMinSize)
+    {
+      insertionSort(words, n);
+      return;
+    }
+    switch (cpuLevel())
+    {
+#ifdef PIXSORT_X86_DISPATCH
+    case CpuLevel::AVX512:
+      avx512Sort(words, n);
+      break;
+    case CpuLevel::AVX2:
+      avx2Sort(words, n);
+      break;
+    case CpuLevel::SSE42:
+      sse42Sort(words, n);
+      break;
+#endif
+#ifdef PIXSORT_NEON
+    case CpuLevel::NEON:
+      neonSort(words, n);
+      break;
+#endif
+    default:
+      scalarSort(words, n);
+      break;
+    }
+  }
+}
@@ -2,89 +2,690 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include "sortingAlgos.hpp"
+#include "mask.hpp"
+#include "radixSort.hpp"
+#include "packedSort.hpp"
+#include "parallelSort.hpp"
+#include "cpuFeatures.hpp"
+#include "numa.hpp"
+#include "scheduler.hpp"
+#include "hugePages.hpp"
 
 namespace pixSort
 {
-   void brightnessWithThreshold(std::vector<cv::Vec3b>& pixels, float threshold)
+   // Packs every pixel's key once, then a stable radix sort on the packed keys
+   // handles threshold, order and tie-breaking keys without a comparator.
+   // Sorts pixels[0..n) in place, so contiguous spans need no copy. When
+   // origins is given it is permuted the same way.
+   // The radix passes are compiled per CPU level (see dispatch).
+   template <typename Pixel>
+   struct SpanSortKernel
    {
-       std::sort(pixels.begin(), pixels.end(),[threshold](const cv::Vec3b& a, const cv::Vec3b& b)
-       {
-          int brightnessA = a[0] + a[1] + a[2];
-          int brightnessB = b[0] + b[1] + b[2];
-          // Only sort pixels with brightness above threshold
-          if (brightnessA < threshold && brightnessB < threshold)
-             return false; // don't reorder both dim pixels
-          if (brightnessA < threshold)
-             return false; // put dimmer pixel later
-          if (brightnessB < threshold)
-             return true;  // put brighter pixel first
-          return brightnessA < brightnessB;
-        });
-    }  
+      PIXSORT_INLINE static void run(Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer, int* origins, SpanPath& path)
+      {
+         // recording where pixels came from needs the permutation itself
+         if (!origins && packer.engine() != SortEngine::Radix)
+         {
+            if constexpr (fitsPacked<uint32_t, Pixel>(0))
+            {
+               if (fitsPacked<uint32_t, Pixel>(packer.bits()))
+               {
+                  if (packer.engine() == SortEngine::Network && n <= networkMaxSize)
+                  {
+                     networkSortByKey(pixels, n, packer);
+                     path = SpanPath::Network;
+                     return;
+                  }
+                  packedSortByKey<uint32_t>(pixels, n, packer);
+                  path = SpanPath::Packed32;
+                  return;
+               }
+            }
+            if constexpr (fitsPacked<uint64_t, Pixel>(0))
+            {
+               if (fitsPacked<uint64_t, Pixel>(packer.bits()))
+               {
+                  packedSortByKey<uint64_t>(pixels, n, packer);
+                  path = SpanPath::Packed64;
+                  return;
+               }
+            }
+         }
+
+         // keys and pixel indices move side by side, then every pixel moves once
+         thread_local std::vector<uint32_t> order;
+         order.resize(n);
+         for (size_t i = 0; i < n; ++i) order[i] = static_cast<uint32_t>(i);
+         if (packer.wide())
+         {
+            thread_local std::vector<uint64_t> keys;
+            keys.resize(n);
+            packer.pack(pixels, n, keys.data());
+            radixSortByKey(keys.data(), order.data(), n, packer.bits());
+         }
+         else
+         {
+            thread_local std::vector<uint32_t> keys;
+            keys.resize(n);
+            packer.pack(pixels, n, keys.data());
+            radixSortByKey(keys.data(), order.data(), n, packer.bits());
+         }
+         if (origins)
+         {
+            thread_local std::vector<int> moved;
+            moved.resize(n);
+            for (size_t i = 0; i < n; ++i) moved[i] = origins[order[i]];
+            std::copy(moved.begin(), moved.end(), origins);
+         }
+         permuteInPlace(pixels, order.data(), n);
+         path = SpanPath::Radix;
+      }
+   };
+
+   // Whether pixels[0..n) already are in the order the stable sort gives,
+   // i.e. their packed keys never descend. Spans entirely under the threshold
+   // have equal keys and pass too. Keys are packed a chunk at a time, so an
+   // unsorted span, the common case, stops after its first chunk.
+   template <typename Word, typename Pixel, bool withPixels>
+   struct SortedCheckKernel
+   {
+      PIXSORT_INLINE static void run(const Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer, bool& sorted)
+      {
+         constexpr size_t chunk = 64;
+         Word keys[chunk];
+         Word last = 0;
+         for (size_t i = 0; i < n; i += chunk)
+         {
+            size_t m = std::min(chunk, n - i);
+            if constexpr (withPixels) { packWords(pixels + i, m, packer, keys); }
+            else { packer.pack(pixels + i, m, keys); }
+
+            // no early exit inside a chunk, so the compares vectorize
+            bool descends = keys[0] < last;
+            for (size_t j = 1; j < m; ++j) descends |= keys[j] < keys[j - 1];
+            if (descends)
+            {
+               sorted = false;
+               return;
+            }
+            last = keys[m - 1];
+         }
+         sorted = true;
+      }
+   };
+
+   template <typename Pixel>
+   bool inOrder(const Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer, const int* origins)
+   {
+      bool sorted = true;
+      if constexpr (fitsPacked<uint32_t, Pixel>(0))
+      {
+         // the network orders equal keys by pixel value, so whole words count there
+         if (!origins && packer.engine() == SortEngine::Network && n <= networkMaxSize
+             && fitsPacked<uint32_t, Pixel>(packer.bits()))
+         {
+            dispatch<SortedCheckKernel<uint32_t, Pixel, true>>(pixels, n, packer, sorted);
+            return sorted;
+         }
+      }
+      if (packer.wide()) { dispatch<SortedCheckKernel<uint64_t, Pixel, false>>(pixels, n, packer, sorted); }
+      else { dispatch<SortedCheckKernel<uint32_t, Pixel, false>>(pixels, n, packer, sorted); }
+      return sorted;
+   }
+
+   // Returns SpanPath::Skipped when the span already was in order
+   template <typename Pixel>
+   SpanPath keyWithThreshold(Pixel* pixels, size_t n, const KeyPacker<Pixel>& packer, int* origins = nullptr)
+   {
+      if (n < 2 || inOrder(pixels, n, packer, origins)) return SpanPath::Skipped;
+      SpanPath path = SpanPath::Radix;
+      dispatch<SpanSortKernel<Pixel>>(pixels, n, packer, origins, path);
+      return path;
+   }
+
+   namespace
+   {
+      std::atomic<uint64_t> lineCount{0}, skippedLineCount{0}, spanCount{0}, pathCounts[spanPathCount];
+
+      // Counts of one worker's range, added to the totals once
+      struct LocalSpanStats
+      {
+         uint64_t lines = 0, skippedLines = 0, paths[spanPathCount] = {};
+
+         void add(uint64_t spans)
+         {
+            lineCount.fetch_add(lines, std::memory_order_relaxed);
+            skippedLineCount.fetch_add(skippedLines, std::memory_order_relaxed);
+            spanCount.fetch_add(spans, std::memory_order_relaxed);
+            for (int p = 0; p < spanPathCount; ++p) pathCounts[p].fetch_add(paths[p], std::memory_order_relaxed);
+         }
+      };
+   }
+
+   SpanStats spanStats()
+   {
+      SpanStats stats;
+      stats.lines = lineCount.load();
+      stats.skippedLines = skippedLineCount.load();
+      stats.spans = spanCount.load();
+      for (int p = 0; p < spanPathCount; ++p) stats.paths[p] = pathCounts[p].load();
+      return stats;
+   }
+
+   void resetSpanStats()
+   {
+      lineCount = 0;
+      skippedLineCount = 0;
+      spanCount = 0;
+      for (std::atomic<uint64_t>& count : pathCounts) count = 0;
+   }
+
+   namespace
+   {
+      std::atomic<int> stripWidth{0};
+   }
+
+   void setColumnStrips(int width)
+   {
+      stripWidth.store(width, std::memory_order_relaxed);
+   }
+
+   int columnStrips()
+   {
+      return stripWidth.load(std::memory_order_relaxed);
+   }
 }
 
-void sortByColumnThresholdCPU(cv::Mat& img, float threshold)
+namespace
 {
-  for (size_t j = 0; j < img.cols; ++j)
-  {    
-    std::vector<cv::Vec3b> column;
-    for (size_t i = 0; i< img.rows; ++i)
+  // Calls fn with a value of the pixel type stored in img
+  template <typename Fn>
+  void withPixelType(const cv::Mat& img, Fn&& fn)
+  {
+    switch (img.type())
     {
-      column.push_back(img.at<cv::Vec3b>(i, j));
+    case CV_8UC3:
+      fn(cv::Vec3b());
+      break;
+    case CV_16UC3:
+      fn(cv::Vec3w());
+      break;
+    case CV_32FC3:
+      fn(cv::Vec3f());
+      break;
+    case CV_8UC4:
+      fn(cv::Vec4b());
+      break;
+    case CV_16UC4:
+      fn(cv::Vec4w());
+      break;
+    case CV_32FC4:
+      fn(cv::Vec4f());
+      break;
+    default:
+      throw std::runtime_error("Unsupported image type, expected 3 or 4 channels of 8-bit, 16-bit or float.\n");
     }
-  
-    pixSort::brightnessWithThreshold(column, threshold);
-  
-    for (size_t i = 0; i < img.rows; ++i)
+  }
+
+  // Copies the src rows in `rows` into the matching dst columns, in square
+  // tiles so both sides stay in cache. Compiled per CPU level (see dispatch).
+  template <typename Pixel>
+  struct TransposeKernel
+  {
+    PIXSORT_INLINE static void run(const cv::Mat& src, cv::Mat& dst, const cv::Range& rows)
     {
-      img.at<cv::Vec3b>(i, j) = column[i];
+      constexpr int tile = 16;
+      for (int i0 = rows.start; i0 < rows.end; i0 += tile)
+      {
+        int i1 = std::min(i0 + tile, rows.end);
+        for (int j0 = 0; j0 < src.cols; j0 += tile)
+        {
+          int j1 = std::min(j0 + tile, src.cols);
+          for (int j = j0; j < j1; ++j)
+          {
+            Pixel* out = dst.ptr<Pixel>(j);
+            for (int i = i0; i < i1; ++i)
+            {
+              out[i] = src.ptr<Pixel>(i)[j];
+            }
+          }
+        }
+      }
     }
-  }  
-}
+  };
 
-void sortByRowThresholdCPU(cv::Mat& img, float threshold)
-{
-  for (size_t i = 0; i < img.rows; ++i)
-  {    
-    std::vector<cv::Vec3b> row;
-    for (size_t j = 0; j < img.cols; ++j)
+  // With NUMA placement the work is split by dst rows the way sortRows splits
+  // them, so the pinned worker that sorts a band of dst is the one that
+  // first touches it
+  template <typename Pixel>
+  void transposeInto(const cv::Mat& src, cv::Mat& dst)
+  {
+    if (pixSort::numaPlacement())
+    {
+      pixSort::numaParallelFor(dst.rows, [&](const cv::Range& rows)
+      {
+        cv::Mat band = dst.rowRange(rows);
+        pixSort::dispatch<TransposeKernel<Pixel>>(src.colRange(rows), band, cv::Range(0, src.rows));
+      });
+      return;
+    }
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& rows)
     {
-      row.push_back(img.at<cv::Vec3b>(i, j));
+      pixSort::dispatch<TransposeKernel<Pixel>>(src, dst, rows);
+    });
+  }
+
+  // Sorts the spans of lines [range.start, range.end) of the span table,
+  // line i being row i - firstLine of img
+  template <typename Pixel>
+  void sortRowSpans(cv::Mat& img, const pixSort::KeyPacker<Pixel>& packer, const pixSort::SpanTable& spans, cv::Mat* origins,
+                    const cv::Range& range, int firstLine = 0)
+  {
+    pixSort::LocalSpanStats stats;
+    for (int i = range.start; i < range.end; ++i)
+    {
+      Pixel* row = img.ptr<Pixel>(i - firstLine);
+      int* originRow = origins ? origins->ptr<int>(i - firstLine) : nullptr;
+      bool sorted = false;
+      for (int s = spans.offsets[i]; s < spans.offsets[i + 1]; ++s)
+      {
+        const cv::Range& span = spans.spans[s];
+        pixSort::SpanPath path = pixSort::keyWithThreshold(row + span.start, span.size(), packer,
+                                                           originRow ? originRow + span.start : nullptr);
+        sorted |= path != pixSort::SpanPath::Skipped;
+        ++stats.paths[int(path)];
+      }
+      stats.lines += spans.offsets[i + 1] > spans.offsets[i];
+      stats.skippedLines += spans.offsets[i + 1] > spans.offsets[i] && !sorted;
+    }
+    stats.add(spans.offsets[range.end] - spans.offsets[range.start]);
+  }
+
+  // Row spans are contiguous, so they are sorted right inside the image.
+  // Rows are stolen between workers, as thresholds and masks make their work
+  // uneven; with NUMA placement every row instead stays with the node that
+  // first touched it.
+  template <typename Pixel>
+  void sortRows(cv::Mat& img, const pixSort::KeyPacker<Pixel>& packer, const pixSort::SpanTable& spans, cv::Mat* origins)
+  {
+    auto sortRange = [&](const cv::Range& range) { sortRowSpans(img, packer, spans, origins, range); };
+    if (pixSort::numaPlacement())
+    {
+      pixSort::numaParallelFor(img.rows, sortRange);
     }
-    
-    pixSort::brightnessWithThreshold(row, threshold);
-    
-    for (size_t j = 0; j < img.cols; ++j)
+    else
     {
-      img.at<cv::Vec3b>(i, j) = row[j];
+      pixSort::stealingParallelFor(img.rows, sortRange);
     }
-  }  
+  }
+
+  // Sorts the columns of img stripWidth at a time: a worker gathers a strip
+  // into rows of its own buffer, sorts them and scatters them back before
+  // taking the next strip. spans are those of the columns, as rows of the
+  // transposed image.
+  template <typename Pixel>
+  void sortColumnStrips(cv::Mat& img, const pixSort::KeyPacker<Pixel>& packer, const pixSort::SpanTable& spans,
+                        cv::Mat* origins, int stripWidth)
+  {
+    int strips = (img.cols + stripWidth - 1) / stripWidth;
+    pixSort::stealingParallelFor(strips, [&](const cv::Range& range)
+    {
+      thread_local cv::Mat strip;
+      thread_local cv::Mat originStrip;
+      for (int s = range.start; s < range.end; ++s)
+      {
+        cv::Range columns(s * stripWidth, std::min(img.cols, (s + 1) * stripWidth));
+        cv::Mat imgStrip = img.colRange(columns.start, columns.end);
+        cv::Mat originView = origins ? origins->colRange(columns.start, columns.end) : cv::Mat();
+
+        strip.create(columns.size(), img.rows, img.type());
+        pixSort::dispatch<TransposeKernel<Pixel>>(imgStrip, strip, cv::Range(0, img.rows));
+        if (origins)
+        {
+          originStrip.create(columns.size(), img.rows, CV_32SC1);
+          pixSort::dispatch<TransposeKernel<int>>(originView, originStrip, cv::Range(0, img.rows));
+        }
+
+        sortRowSpans(strip, packer, spans, origins ? &originStrip : nullptr, columns, columns.start);
+
+        pixSort::dispatch<TransposeKernel<Pixel>>(strip, imgStrip, cv::Range(0, columns.size()));
+        if (origins) pixSort::dispatch<TransposeKernel<int>>(originStrip, originView, cv::Range(0, columns.size()));
+      }
+    });
+  }
+
+  // Columns per strip so that a strip and its origins fill about half of L2,
+  // in whole 16-pixel tiles
+  int l2StripWidth(const cv::Mat& img, bool origins)
+  {
+    size_t columnBytes = img.rows * (img.elemSize() + (origins ? sizeof(int) : 0));
+    int width = static_cast<int>(pixSort::l2CacheBytes() / 2 / std::max<size_t>(columnBytes, 1)) / 16 * 16;
+    return std::max(16, width);
+  }
+
+  template <typename Pixel>
+  void sortLines(cv::Mat& img, const pixSort::KeyPacker<Pixel>& packer, const pixSort::LineTable& lines, const pixSort::SpanTable& spans,
+                 cv::Mat* origins)
+  {
+    Pixel* pixels = img.ptr<Pixel>(0);
+    int* originPixels = origins ? origins->ptr<int>(0) : nullptr;
+
+    // Lines are disjoint, so every worker can gather, sort and scatter its own
+    pixSort::stealingParallelFor(static_cast<int>(lines.lineCount()), [&](const cv::Range& range)
+    {
+      std::vector<Pixel> line;
+      std::vector<int> lineOrigins;
+      pixSort::LocalSpanStats stats;
+      for (int k = range.start; k < range.end; ++k)
+      {
+        const int* index = lines.index.data() + lines.offsets[k];
+        bool sorted = false;
+        for (int s = spans.offsets[k]; s < spans.offsets[k + 1]; ++s)
+        {
+          const int* first = index + spans.spans[s].start;
+          const int* last = index + spans.spans[s].end;
+
+          line.clear();
+          lineOrigins.clear();
+          for (const int* idx = first; idx != last; ++idx)
+          {
+            line.push_back(pixels[*idx]);
+            if (originPixels) lineOrigins.push_back(originPixels[*idx]);
+          }
+
+          // spans already in order need no scatter either
+          pixSort::SpanPath path = pixSort::keyWithThreshold(line.data(), line.size(), packer,
+                                                             originPixels ? lineOrigins.data() : nullptr);
+          ++stats.paths[int(path)];
+          if (path == pixSort::SpanPath::Skipped) continue;
+          sorted = true;
+
+          for (size_t n = 0; n < line.size(); ++n)
+          {
+            pixels[first[n]] = line[n];
+            if (originPixels) originPixels[first[n]] = lineOrigins[n];
+          }
+        }
+        stats.lines += spans.offsets[k + 1] > spans.offsets[k];
+        stats.skippedLines += spans.offsets[k + 1] > spans.offsets[k] && !sorted;
+      }
+      stats.add(spans.offsets[range.end] - spans.offsets[range.start]);
+    });
+  }
+
+  void sortAlongLinesCPU(cv::Mat& img, const pixSort::LineTable& lines, float threshold,
+                         const pixSort::SortKey& key, const cv::Mat& mask, cv::Mat* origins)
+  {
+    if (!img.isContinuous()) { img = img.clone(); }
+    pixSort::SpanTable spans = pixSort::lineSpans(mask, lines);
+    withPixelType(img, [&](auto pixel)
+    {
+      using Pixel = decltype(pixel);
+      sortLines(img, pixSort::KeyPacker<Pixel>(key, threshold), lines, spans, origins);
+    });
+  }
+
+  // Counter-based draws (splitmix64 of seed and draw index), so draw i is the
+  // same whichever thread makes it
+  uint64_t splitmix64(uint64_t x)
+  {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+
+  size_t drawIndex(uint64_t seed, uint64_t draw, size_t range)
+  {
+    uint64_t bits = splitmix64(seed ^ splitmix64(draw));
+    // 32 random bits scaled to the range, or all 64 of them past 2^32
+    if (range > UINT32_MAX) return static_cast<size_t>(bits % range);
+    return static_cast<size_t>(((bits >> 32) * range) >> 32);
+  }
+
+  // Runs fn(begin, end) over [0, n) in blocks on the cv::parallel_for_ workers
+  template <typename Fn>
+  void parallelBlocks(size_t n, Fn&& fn)
+  {
+    constexpr size_t block = 4096;
+    cv::parallel_for_(cv::Range(0, static_cast<int>((n + block - 1) / block)), [&](const cv::Range& range)
+    {
+      fn(range.start * block, std::min(n, range.end * block));
+    });
+  }
+
+  // Draws relEntropy * area positions (with repeats), sorts the pixels found
+  // there and writes them back in draw order, so a position drawn twice keeps
+  // its last pixel. Every step runs in parallel and the result only depends
+  // on the seed, not on the thread count.
+  template <typename Pixel>
+  void randomSort(cv::Mat& img, float relEntropy, const pixSort::SortKey& key, const cv::Mat& mask, uint64_t seed,
+                  cv::Mat* origins)
+  {
+    // with a mask, positions are only drawn from the masked pixels
+    std::vector<cv::Point> candidates;
+    if (!mask.empty()) { cv::findNonZero(mask, candidates); }
+
+    size_t imgArea = mask.empty() ? img.total() : candidates.size();
+    size_t entropy = static_cast<size_t>(imgArea * double(relEntropy));
+    if (entropy == 0) return;
+
+    // gathered and scattered at random, so these are worth huge pages too.
+    // Positions and draw indices are 64-bit: gigapixel images and draw
+    // counts past 2^31 are both in reach.
+    pixSort::HugeVector<uint64_t> randPos(entropy);
+    pixSort::HugeVector<Pixel> randPixels(entropy);
+    pixSort::HugeVector<int> randOrigins(origins ? entropy : 0);
+    pixSort::HugeVector<uint64_t> order(entropy);
+    pixSort::KeyPacker<Pixel> packer(key, 0); // same as sorting with no threshold
+
+    auto sortDraws = [&](auto word)
+    {
+      using Word = decltype(word);
+      pixSort::HugeVector<Word> keys(entropy);
+      parallelBlocks(entropy, [&](size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+        {
+          size_t draw = drawIndex(seed, i, imgArea);
+          cv::Point pos = mask.empty() ? cv::Point(static_cast<int>(draw % img.cols), static_cast<int>(draw / img.cols))
+                                       : candidates[draw];
+          randPos[i] = uint64_t(pos.y) * img.cols + pos.x;
+          randPixels[i] = img.ptr<Pixel>(pos.y)[pos.x];
+          if (origins) randOrigins[i] = origins->ptr<int>(pos.y)[pos.x];
+          order[i] = i;
+        }
+        packer.pack(randPixels.data() + begin, end - begin, keys.data() + begin);
+      });
+      // sorting draw indices lets pixels and origins follow in one gather
+      pixSort::parallelRadixSortByKey(keys.data(), order.data(), entropy, packer.bits());
+    };
+    if (packer.wide()) { sortDraws(uint64_t()); }
+    else { sortDraws(uint32_t()); }
+
+    // the last draw of each position is the one that lands. A stable sort
+    // of the draws by position puts it at the end of its position's run, and
+    // needs memory for the draws only, not for every pixel.
+    pixSort::HugeVector<uint64_t> posKeys(entropy);
+    pixSort::HugeVector<uint64_t> byPos(entropy);
+    parallelBlocks(entropy, [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        posKeys[i] = randPos[i];
+        byPos[i] = i;
+      }
+    });
+    int posBits = 1;
+    while (posBits < 64 && (uint64_t(1) << posBits) < img.total()) ++posBits;
+    pixSort::parallelRadixSortByKey(posKeys.data(), byPos.data(), entropy, posBits);
+
+    // every position is written once, so the blocks never collide
+    parallelBlocks(entropy, [&](size_t begin, size_t end)
+    {
+      for (size_t j = begin; j < end; ++j)
+      {
+        uint64_t pos = randPos[byPos[j]];
+        if (j + 1 < entropy && randPos[byPos[j + 1]] == pos) continue;
+        uint64_t i = byPos[j];
+        int y = static_cast<int>(pos / img.cols), x = static_cast<int>(pos % img.cols);
+        img.ptr<Pixel>(y)[x] = randPixels[order[i]];
+        if (origins) origins->ptr<int>(y)[x] = randOrigins[order[i]];
+      }
+    });
+  }
+
+  // Like randomSort, but every tile x tile block draws and sorts only its own
+  // pixels, so nothing moves further than a tile. Tiles are independent and
+  // small enough to stay in cache, so each worker takes whole tiles.
+  template <typename Pixel>
+  void localRandomSort(cv::Mat& img, float relEntropy, int tile, const pixSort::SortKey& key, const cv::Mat& mask,
+                       uint64_t seed, cv::Mat* origins)
+  {
+    int tilesX = (img.cols + tile - 1) / tile;
+    int tilesY = (img.rows + tile - 1) / tile;
+    pixSort::KeyPacker<Pixel> packer(key, 0);
+
+    pixSort::stealingParallelFor(tilesX * tilesY, [&](const cv::Range& range)
+    {
+      std::vector<cv::Point> candidates;
+      std::vector<cv::Point> randPos;
+      std::vector<Pixel> randPixels;
+      std::vector<int> randOrigins;
+      for (int t = range.start; t < range.end; ++t)
+      {
+        cv::Rect rect((t % tilesX) * tile, (t / tilesX) * tile, 0, 0);
+        rect.width = std::min(tile, img.cols - rect.x);
+        rect.height = std::min(tile, img.rows - rect.y);
+
+        candidates.clear();
+        if (!mask.empty())
+        {
+          for (int y = rect.y; y < rect.y + rect.height; ++y)
+          {
+            const uchar* row = mask.ptr<uchar>(y);
+            for (int x = rect.x; x < rect.x + rect.width; ++x)
+            {
+              if (row[x]) candidates.emplace_back(x, y);
+            }
+          }
+        }
+
+        size_t tileArea = mask.empty() ? size_t(rect.area()) : candidates.size();
+        size_t entropy = static_cast<size_t>(tileArea * relEntropy);
+        randPos.resize(entropy);
+        randPixels.resize(entropy);
+        randOrigins.resize(origins ? entropy : 0);
+
+        // draws are numbered per tile, so tiles do not share a sequence
+        for (size_t i = 0; i < entropy; ++i)
+        {
+          size_t draw = drawIndex(seed, (uint64_t(t) << 32) | i, tileArea);
+          randPos[i] = mask.empty() ? cv::Point(rect.x + static_cast<int>(draw % rect.width), rect.y + static_cast<int>(draw / rect.width))
+                                    : candidates[draw];
+          randPixels[i] = img.ptr<Pixel>(randPos[i].y)[randPos[i].x];
+          if (origins) randOrigins[i] = origins->ptr<int>(randPos[i].y)[randPos[i].x];
+        }
+
+        pixSort::keyWithThreshold(randPixels.data(), randPixels.size(), packer, origins ? randOrigins.data() : nullptr);
+
+        for (size_t i = 0; i < entropy; ++i)
+        {
+          img.ptr<Pixel>(randPos[i].y)[randPos[i].x] = randPixels[i];
+          if (origins) origins->ptr<int>(randPos[i].y)[randPos[i].x] = randOrigins[i];
+        }
+      }
+    });
+  }
+}
+
+void sortByColumnThresholdCPU(cv::Mat& img, float threshold, const pixSort::SortKey& key, const cv::Mat& mask,
+                              cv::Mat* origins)
+{
+  // columns become contiguous rows of the transposed image
+  pixSort::SpanTable spans = pixSort::rowSpans(mask.empty() ? mask : cv::Mat(mask.t()), img.cols, img.rows);
+  int stripWidth = pixSort::columnStrips();
+  if (stripWidth != 0)
+  {
+    withPixelType(img, [&](auto pixel)
+    {
+      using Pixel = decltype(pixel);
+      sortColumnStrips(img, pixSort::KeyPacker<Pixel>(key, threshold), spans, origins,
+                       stripWidth > 0 ? stripWidth : l2StripWidth(img, origins));
+    });
+    return;
+  }
+
+  // released on return: kept between calls they would hold a whole image
+  // through display and encoding
+  cv::Mat columns;
+  cv::Mat originColumns;
+  if (origins)
+  {
+    originColumns.create(img.cols, img.rows, CV_32SC1);
+    transposeInto<int>(*origins, originColumns);
+  }
+  withPixelType(img, [&](auto pixel)
+  {
+    using Pixel = decltype(pixel);
+    columns.create(img.cols, img.rows, img.type());
+    transposeInto<Pixel>(img, columns);
+    sortRows(columns, pixSort::KeyPacker<Pixel>(key, threshold), spans, origins ? &originColumns : nullptr);
+    transposeInto<Pixel>(columns, img);
+  });
+  if (origins)
+  {
+    transposeInto<int>(originColumns, *origins);
+  }
 }
 
-void randomSortCPU(cv::Mat& img, float relEntropy)
+void sortByRowThresholdCPU(cv::Mat& img, float threshold, const pixSort::SortKey& key, const cv::Mat& mask,
+                           cv::Mat* origins)
 {
-  cv::RNG rng;
-  
-  int imgArea = img.cols * img.rows;
-  int entropy = static_cast<int>(imgArea * relEntropy);
-  
-  std::vector<cv::Vec3b> randPixels;
-  std::vector<cv::Point> randPos;
-  
-  for (int i = 0; i < entropy; ++i)
-  {
-    int row = rng.uniform(0, img.rows);
-    int col = rng.uniform(0, img.cols);
-    randPos.push_back(cv::Point(col,row));
-    randPixels.push_back(img.at<cv::Vec3b>(row, col));
-  }
-  
-  pixSort::brightnessWithThreshold(randPixels, 0); // same as sorting with no threshold
-  
-  for (size_t i = 0; i < entropy; ++i)
-  {
-    img.at<cv::Vec3b>(randPos[i].y, randPos[i].x) = randPixels[i];
+  pixSort::SpanTable spans = pixSort::rowSpans(mask, img.rows, img.cols);
+  withPixelType(img, [&](auto pixel)
+  {
+    using Pixel = decltype(pixel);
+    sortRows(img, pixSort::KeyPacker<Pixel>(key, threshold), spans, origins);
+  });
+}
+
+void sortByAngleThresholdCPU(cv::Mat& img, float threshold, float angle, const pixSort::SortKey& key, const cv::Mat& mask,
+                             cv::Mat* origins)
+{
+  sortAlongLinesCPU(img, *pixSort::angleLines(img.rows, img.cols, angle), threshold, key, mask, origins);
+}
+
+void sortByCurveThresholdCPU(cv::Mat& img, float threshold, pixSort::Curve curve, int segmentLength,
+                             const pixSort::SortKey& key, const cv::Mat& mask, cv::Mat* origins)
+{
+  sortAlongLinesCPU(img, *pixSort::curveLines(curve, img.rows, img.cols, segmentLength), threshold, key, mask, origins);
+}
+
+void randomSortCPU(cv::Mat& img, float relEntropy, const pixSort::SortKey& key, const cv::Mat& mask, uint64_t seed,
+                   cv::Mat* origins)
+{
+  if (!(relEntropy >= 0))
+  {
+    throw std::runtime_error("Relative entropy must not be negative.\n");
+  }
+  withPixelType(img, [&](auto pixel) { randomSort<decltype(pixel)>(img, relEntropy, key, mask, seed, origins); });
+}
+
+void localRandomSortCPU(cv::Mat& img, float relEntropy, int tile, const pixSort::SortKey& key, const cv::Mat& mask,
+                        uint64_t seed, cv::Mat* origins)
+{
+  if (tile < 1)
+  {
+    throw std::runtime_error("Tile size must be at least 1.\n");
+  }
+  if (!(relEntropy >= 0))
+  {
+    throw std::runtime_error("Relative entropy must not be negative.\n");
   }
+  withPixelType(img, [&](auto pixel) { localRandomSort<decltype(pixel)>(img, relEntropy, tile, key, mask, seed, origins); });
 }
 
 void imagePrint(cv::Mat& img)
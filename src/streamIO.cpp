@@ -0,0 +1,100 @@
+#include "streamIO.hpp"
+
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <cstdio>
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace pixSort
+{
+  void setBinaryStdio()
+  {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  }
+
+  int decodeFlags(const uchar* head, size_t size)
+  {
+    bool jpeg = size >= 3 && head[0] == 0xFF && head[1] == 0xD8 && head[2] == 0xFF;
+    return jpeg ? cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH : cv::IMREAD_UNCHANGED;
+  }
+
+  int decodeFlags(const std::string& file)
+  {
+    uchar head[3] = {};
+    std::ifstream in(file, std::ios::binary);
+    in.read(reinterpret_cast<char*>(head), sizeof(head));
+    return decodeFlags(head, static_cast<size_t>(in.gcount()));
+  }
+
+  cv::Mat decodeStream(std::istream& in)
+  {
+    // read in large blocks, a pipe rarely says how much is coming
+    constexpr size_t block = size_t(1) << 20;
+    std::vector<uchar> bytes;
+    for (;;)
+    {
+      size_t size = bytes.size();
+      bytes.resize(size + block);
+      in.read(reinterpret_cast<char*>(bytes.data() + size), block);
+      bytes.resize(size + static_cast<size_t>(in.gcount()));
+      if (!in) break;
+    }
+
+    cv::Mat img = bytes.empty() ? cv::Mat() : cv::imdecode(bytes, decodeFlags(bytes.data(), bytes.size()));
+    if (img.empty())
+    {
+      throw std::runtime_error("Failed to decode an image from standard input.\n");
+    }
+    return img;
+  }
+
+  void encodeStream(std::ostream& out, const std::string& ext, const cv::Mat& img, const std::vector<int>& params)
+  {
+    std::vector<uchar> bytes;
+    if (!cv::imencode(ext, img, bytes, params))
+    {
+      throw std::runtime_error("Failed to encode the image as " + ext + "\n");
+    }
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    out.flush();
+    if (!out)
+    {
+      throw std::runtime_error("Failed to write the image to standard output.\n");
+    }
+  }
+
+  bool readRawFrame(std::istream& in, cv::Mat& frame)
+  {
+    CV_Assert(frame.isContinuous());
+    size_t size = frame.total() * frame.elemSize();
+    in.read(reinterpret_cast<char*>(frame.data), size);
+    size_t got = static_cast<size_t>(in.gcount());
+    if (got == 0 && in.eof()) return false;
+    if (got != size)
+    {
+      throw std::runtime_error("Truncated raw frame: got " + std::to_string(got) + " of "
+                               + std::to_string(size) + " bytes.\n");
+    }
+    return true;
+  }
+
+  void writeRawFrame(std::ostream& out, const cv::Mat& frame)
+  {
+    for (int y = 0; y < frame.rows; ++y)
+    {
+      out.write(frame.ptr<char>(y), frame.cols * frame.elemSize());
+    }
+    if (!out)
+    {
+      throw std::runtime_error("Failed to write a raw frame.\n");
+    }
+  }
+}
@@ -0,0 +1,233 @@
+#include "traversal.hpp"
+
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <tuple>
+#include <algorithm>
+
+namespace pixSort
+{
+  namespace
+  {
+    constexpr double pi = 3.14159265358979323846;
+
+    // The few most recently used tables. A table has an entry per pixel, so
+    // keeping one per image size or angle ever seen grows without bound in
+    // long batch runs; a chain or a video only cycles through a handful.
+    template <typename Key>
+    class TableCache
+    {
+    public:
+      template <typename Build>
+      std::shared_ptr<const LineTable> get(const Key& key, Build build)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+          if (it->first == key)
+          {
+            entries.splice(entries.begin(), entries, it);
+            return it->second;
+          }
+        }
+        entries.emplace_front(key, build());
+        if (entries.size() > capacity) entries.pop_back();
+        return entries.front().second;
+      }
+
+    private:
+      static constexpr size_t capacity = 4;
+      std::mutex mutex;
+      std::list<std::pair<Key, std::shared_ptr<const LineTable>>> entries;
+    };
+
+    // Minor-axis offset of each step along the major axis for a Bresenham
+    // line from (0,0) to (length-1, delta), |delta| <= length-1.
+    std::vector<int> bresenhamOffsets(int length, int delta)
+    {
+      std::vector<int> offsets(length, 0);
+      int run = length - 1;
+      int rise = std::abs(delta);
+      int sign = delta < 0 ? -1 : 1;
+      int err = 2 * rise - run;
+      int y = 0;
+      for (int x = 0; x < length; ++x)
+      {
+        offsets[x] = y;
+        if (err > 0)
+        {
+          y += sign;
+          err -= 2 * run;
+        }
+        err += 2 * rise;
+      }
+      return offsets;
+    }
+
+    std::shared_ptr<LineTable> buildAngleLines(int rows, int cols, float angleDeg)
+    {
+      double rad = angleDeg * pi / 180.0;
+      double dx = std::cos(rad);
+      double dy = -std::sin(rad); // image rows grow downwards
+      bool steep = std::abs(dy) > std::abs(dx);
+
+      int major = steep ? rows : cols;
+      int minor = steep ? cols : rows;
+      double slope = steep ? dx / dy : dy / dx;
+      bool reversed = steep ? dy < 0 : dx < 0;
+
+      std::vector<int> offsets = bresenhamOffsets(major, static_cast<int>(std::lround(slope * (major - 1))));
+      auto [minOff, maxOff] = std::minmax_element(offsets.begin(), offsets.end());
+
+      auto table = std::make_shared<LineTable>();
+      table->index.reserve(static_cast<size_t>(rows) * cols);
+      // Consecutive lines are neighbours in the image, so a worker handling a
+      // contiguous block of lines keeps touching the same cache lines.
+      for (int start = -*maxOff; start < minor - *minOff; ++start)
+      {
+        size_t first = table->index.size();
+        for (int k = 0; k < major; ++k)
+        {
+          int m = start + offsets[k];
+          if (m < 0 || m >= minor) continue;
+          table->index.push_back(steep ? k * cols + m : m * cols + k);
+        }
+        if (table->index.size() == first) continue;
+        if (reversed) std::reverse(table->index.begin() + first, table->index.end());
+        table->offsets.push_back(static_cast<int>(table->index.size()));
+      }
+      return table;
+    }
+
+    int sign(int v) { return (v > 0) - (v < 0); }
+    int floorHalf(int v) { return v >= 0 ? v / 2 : -((1 - v) / 2); }
+
+    // Generalized Hilbert ("gilbert") curve over the rectangle spanned by the
+    // major axis (ax, ay) and the minor axis (bx, by) starting at (x, y).
+    void gilbert(std::vector<int>& out, int cols, int x, int y, int ax, int ay, int bx, int by)
+    {
+      int w = std::abs(ax + ay);
+      int h = std::abs(bx + by);
+      int dax = sign(ax), day = sign(ay);
+      int dbx = sign(bx), dby = sign(by);
+
+      if (h == 1 || w == 1)
+      {
+        int n = h == 1 ? w : h;
+        int sx = h == 1 ? dax : dbx;
+        int sy = h == 1 ? day : dby;
+        for (int i = 0; i < n; ++i, x += sx, y += sy)
+        {
+          out.push_back(y * cols + x);
+        }
+        return;
+      }
+
+      int ax2 = floorHalf(ax), ay2 = floorHalf(ay);
+      int bx2 = floorHalf(bx), by2 = floorHalf(by);
+      int w2 = std::abs(ax2 + ay2);
+      int h2 = std::abs(bx2 + by2);
+
+      if (2 * w > 3 * h)
+      {
+        // long rectangle: split along the major axis only
+        if ((w2 % 2) && w > 2) { ax2 += dax; ay2 += day; }
+        gilbert(out, cols, x, y, ax2, ay2, bx, by);
+        gilbert(out, cols, x + ax2, y + ay2, ax - ax2, ay - ay2, bx, by);
+      }
+      else
+      {
+        if ((h2 % 2) && h > 2) { bx2 += dbx; by2 += dby; }
+        gilbert(out, cols, x, y, bx2, by2, ax2, ay2);
+        gilbert(out, cols, x + bx2, y + by2, ax, ay, bx - bx2, by - by2);
+        gilbert(out, cols, x + (ax - dax) + (bx2 - dbx), y + (ay - day) + (by2 - dby),
+                -bx2, -by2, -(ax - ax2), -(ay - ay2));
+      }
+    }
+
+    void spiral(std::vector<int>& out, int rows, int cols)
+    {
+      int top = 0, bottom = rows - 1, left = 0, right = cols - 1;
+      while (top <= bottom && left <= right)
+      {
+        for (int j = left; j <= right; ++j) out.push_back(top * cols + j);
+        for (int i = top + 1; i <= bottom; ++i) out.push_back(i * cols + right);
+        if (top < bottom)
+        {
+          for (int j = right - 1; j >= left; --j) out.push_back(bottom * cols + j);
+        }
+        if (left < right)
+        {
+          for (int i = bottom - 1; i > top; --i) out.push_back(i * cols + left);
+        }
+        ++top; --bottom; ++left; --right;
+      }
+    }
+
+    void zigzag(std::vector<int>& out, int rows, int cols)
+    {
+      for (int d = 0; d < rows + cols - 1; ++d)
+      {
+        int rowHigh = std::min(d, rows - 1);
+        int rowLow = std::max(0, d - cols + 1);
+        if (d % 2 == 0)
+        {
+          for (int i = rowHigh; i >= rowLow; --i) out.push_back(i * cols + (d - i));
+        }
+        else
+        {
+          for (int i = rowLow; i <= rowHigh; ++i) out.push_back(i * cols + (d - i));
+        }
+      }
+    }
+
+    std::shared_ptr<LineTable> buildCurveLines(Curve curve, int rows, int cols, int segmentLength)
+    {
+      auto table = std::make_shared<LineTable>();
+      table->index.reserve(static_cast<size_t>(rows) * cols);
+      switch (curve)
+      {
+      case Curve::Hilbert:
+        // Hilbert segments stay inside compact blocks, so each one only touches
+        // a handful of cache lines even on very wide images
+        if (cols >= rows) { gilbert(table->index, cols, 0, 0, cols, 0, 0, rows); }
+        else { gilbert(table->index, cols, 0, 0, 0, rows, cols, 0); }
+        break;
+      case Curve::Spiral:
+        spiral(table->index, rows, cols);
+        break;
+      case Curve::Zigzag:
+        zigzag(table->index, rows, cols);
+        break;
+      }
+
+      int total = static_cast<int>(table->index.size());
+      int step = segmentLength > 0 ? segmentLength : std::max(total, 1);
+      for (int end = step; end < total; end += step)
+      {
+        table->offsets.push_back(end);
+      }
+      table->offsets.push_back(total);
+      return table;
+    }
+  }
+
+  std::shared_ptr<const LineTable> angleLines(int rows, int cols, float angleDeg)
+  {
+    static TableCache<std::tuple<int, int, float>> cache;
+
+    angleDeg = std::fmod(angleDeg, 360.0f);
+    if (angleDeg < 0) angleDeg += 360.0f;
+
+    return cache.get(std::make_tuple(rows, cols, angleDeg), [&] { return buildAngleLines(rows, cols, angleDeg); });
+  }
+
+  std::shared_ptr<const LineTable> curveLines(Curve curve, int rows, int cols, int segmentLength)
+  {
+    static TableCache<std::tuple<Curve, int, int, int>> cache;
+
+    return cache.get(std::make_tuple(curve, rows, cols, std::max(segmentLength, 0)),
+                     [&] { return buildCurveLines(curve, rows, cols, segmentLength); });
+  }
+}